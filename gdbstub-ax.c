@@ -0,0 +1,571 @@
+/*
+ * gdbstub-ax.c
+ *
+ *  Created on: Oct 17, 2026
+ *
+ * Interpreter for GDB agent expressions, the bytecode GDB uses for
+ * breakpoint conditions evaluated on the target. See "Agent Expressions"
+ * in the GDB manual for the opcode semantics.
+ *
+ * Values are 64 bit wide like in GDB itself. The stack lives on the
+ * exception stack and takes GDBSTUB_AX_STACK * 8 bytes; the number of
+ * executed opcodes is capped at GDBSTUB_AX_STEPS so a broken or looping
+ * expression can't hang the target. Anything the interpreter doesn't
+ * support (floating point, trace state variables) makes the evaluation
+ * fail, which callers treat like a true condition.
+ *
+ * The printf opcode of dprintf commands is sent to the GDB console as a
+ * single 'O' packet.
+ */
+
+#include "gdbstub.h"
+#include "gdbstub-cfg.h"
+#include "gdbstub-ax.h"
+#include "gdbstub-internal.h"
+
+#include <string.h>
+
+typedef enum {
+	ax_op_add = 0x02,
+	ax_op_sub = 0x03,
+	ax_op_mul = 0x04,
+	ax_op_div_signed = 0x05,
+	ax_op_div_unsigned = 0x06,
+	ax_op_rem_signed = 0x07,
+	ax_op_rem_unsigned = 0x08,
+	ax_op_lsh = 0x09,
+	ax_op_rsh_signed = 0x0a,
+	ax_op_rsh_unsigned = 0x0b,
+	ax_op_trace = 0x0c,
+	ax_op_trace_quick = 0x0d,
+	ax_op_log_not = 0x0e,
+	ax_op_bit_and = 0x0f,
+	ax_op_bit_or = 0x10,
+	ax_op_bit_xor = 0x11,
+	ax_op_bit_not = 0x12,
+	ax_op_equal = 0x13,
+	ax_op_less_signed = 0x14,
+	ax_op_less_unsigned = 0x15,
+	ax_op_ext = 0x16,
+	ax_op_ref8 = 0x17,
+	ax_op_ref16 = 0x18,
+	ax_op_ref32 = 0x19,
+	ax_op_ref64 = 0x1a,
+	ax_op_if_goto = 0x20,
+	ax_op_goto = 0x21,
+	ax_op_const8 = 0x22,
+	ax_op_const16 = 0x23,
+	ax_op_const32 = 0x24,
+	ax_op_const64 = 0x25,
+	ax_op_reg = 0x26,
+	ax_op_end = 0x27,
+	ax_op_dup = 0x28,
+	ax_op_pop = 0x29,
+	ax_op_zero_ext = 0x2a,
+	ax_op_swap = 0x2b,
+	ax_op_tracenz = 0x2f,
+	ax_op_trace16 = 0x30,
+	ax_op_pick = 0x32,
+	ax_op_rot = 0x33,
+	ax_op_printf = 0x34
+} ax_op_t;
+
+// printf flags
+#define AX_FMT_LEFT		(1 << 0)
+#define AX_FMT_ZERO		(1 << 1)
+#define AX_FMT_ALT		(1 << 2)
+#define AX_FMT_PLUS		(1 << 3)
+#define AX_FMT_SPACE	(1 << 4)
+
+// Max number of chars printed for a %s without precision
+#define AX_FMT_STR_MAX	256
+
+// Cycles spent in the last evaluation, 'print gdbstub_ax_ccount' in GDB.
+uint32_t gdbstub_ax_ccount;
+
+// Fetch a big-endian operand of 'bytes' bytes following the opcode.
+static uint64_t ax_operand(const uint8_t * code, size_t len, size_t * pc, size_t bytes, bool * ok) {
+	uint64_t v = 0;
+
+	if (*pc + bytes > len) {
+		*ok = false;
+		return 0;
+	}
+
+	while (bytes-- > 0) {
+		v = (v << 8) | code[(*pc)++];
+	}
+
+	return v;
+}
+
+static int64_t ax_sign_extend(uint64_t v, size_t bits) {
+	if (bits >= 64) {
+		return v;
+	}
+
+	uint64_t sign = 1ULL << (bits - 1);
+	v &= (sign << 1) - 1;
+	return (v ^ sign) - sign;
+}
+
+static void ax_pad(char c, int n) {
+	while (n-- > 0) {
+		gdb_console_char(c);
+	}
+}
+
+// Print an integer; prec is -1 if none was given.
+static void ax_print_num(uint64_t v, bool negative, unsigned base, bool upper,
+		unsigned flags, int width, int prec) {
+	const char * digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	const char * prefix = "";
+	char buf[22];
+	int n = 0;
+
+	if (negative) {
+		prefix = "-";
+	} else if (flags & AX_FMT_PLUS) {
+		prefix = "+";
+	} else if (flags & AX_FMT_SPACE) {
+		prefix = " ";
+	}
+
+	if ((flags & AX_FMT_ALT) && v != 0) {
+		if (base == 16) {
+			prefix = upper ? "0X" : "0x";
+		} else if (base == 8) {
+			prefix = "0";
+		}
+	}
+
+	if (v != 0 || prec != 0) {
+		do {
+			buf[n++] = digits[v % base];
+			v /= base;
+		} while (v != 0);
+	}
+
+	int zeros = prec > n ? prec - n : 0;
+	int total = strlen(prefix) + zeros + n;
+
+	if ((flags & (AX_FMT_LEFT | AX_FMT_ZERO)) == AX_FMT_ZERO && prec < 0 && width > total) {
+		zeros += width - total;
+		total = width;
+	}
+
+	if (!(flags & AX_FMT_LEFT)) {
+		ax_pad(' ', width - total);
+	}
+
+	while (*prefix != 0) {
+		gdb_console_char(*prefix++);
+	}
+
+	ax_pad('0', zeros);
+
+	while (n > 0) {
+		gdb_console_char(buf[--n]);
+	}
+
+	if (flags & AX_FMT_LEFT) {
+		ax_pad(' ', width - total);
+	}
+}
+
+// Print a string from target memory.
+static void ax_print_str(uintptr_t addr, unsigned flags, int width, int prec) {
+	size_t max = prec >= 0 ? (size_t) prec : AX_FMT_STR_MAX;
+	size_t len = 0;
+	uint8_t c;
+
+	while (len < max && gdbstub_mem_read(addr + len, &c, 1) && c != 0) {
+		len++;
+	}
+
+	if (!(flags & AX_FMT_LEFT)) {
+		ax_pad(' ', width - (int) len);
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		gdbstub_mem_read(addr + i, &c, 1);
+		gdb_console_char(c);
+	}
+
+	if (flags & AX_FMT_LEFT) {
+		ax_pad(' ', width - (int) len);
+	}
+}
+
+// Translate the char following a backslash in a format string.
+static char ax_escape(char c) {
+	switch (c) {
+	case 'a':
+		return '\a';
+	case 'b':
+		return '\b';
+	case 'e':
+		return 0x1b;
+	case 'f':
+		return '\f';
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	case 't':
+		return '\t';
+	case 'v':
+		return '\v';
+	default:
+		return c;
+	}
+}
+
+/*
+ * Implementation of the printf opcode. The format string is the one typed
+ * into GDB, escape sequences included. Arguments are in stack order, the
+ * first one is args[nargs - 1]. Integer conversions, %c, %s and %p are
+ * supported; floating point isn't.
+ */
+static void ax_printf(const char * f, size_t nargs, const int64_t * args) {
+	size_t arg = 0;
+
+	// Application output from before the breakpoint goes first
+	gdb_console_flush();
+	gdb_console_start();
+
+	for (; *f != 0; f++) {
+		if (*f == '\\' && f[1] != 0) {
+			gdb_console_char(ax_escape(*++f));
+			continue;
+		}
+
+		if (*f != '%' || f[1] == 0) {
+			gdb_console_char(*f);
+			continue;
+		}
+
+		unsigned flags = 0;
+		int width = 0;
+		int prec = -1;
+		int bits = 32;
+
+		for (f++; *f != 0 && strchr("-0#+ ", *f) != NULL; f++) {
+			flags |= 1 << (strchr("-0#+ ", *f) - "-0#+ ");
+		}
+
+		for (; *f >= '0' && *f <= '9'; f++) {
+			width = width * 10 + *f - '0';
+		}
+
+		if (*f == '.') {
+			for (prec = 0, f++; *f >= '0' && *f <= '9'; f++) {
+				prec = prec * 10 + *f - '0';
+			}
+		}
+
+		// int and long are 32 bit wide on the target
+		for (; *f != 0 && strchr("hlLqjzt", *f) != NULL; f++) {
+			if (*f == 'h') {
+				bits /= 2;
+			} else if (*f == 'j' || *f == 'q' || *f == 'L' || (*f == 'l' && f[1] == 'l')) {
+				bits = 64;
+			}
+		}
+
+		if (*f == 0) {
+			break;
+		} else if (*f == '%') {
+			gdb_console_char('%');
+			continue;
+		}
+
+		uint64_t v = arg < nargs ? args[nargs - 1 - arg++] : 0;
+		int64_t sv = ax_sign_extend(v, bits);
+
+		if (bits < 64) {
+			v &= (1ULL << bits) - 1;
+		}
+
+		switch (*f) {
+		case 'd':
+		case 'i':
+			ax_print_num(sv < 0 ? -(uint64_t) sv : (uint64_t) sv, sv < 0, 10, false, flags, width, prec);
+			break;
+		case 'u':
+			ax_print_num(v, false, 10, false, flags, width, prec);
+			break;
+		case 'o':
+			ax_print_num(v, false, 8, false, flags, width, prec);
+			break;
+		case 'x':
+		case 'X':
+			ax_print_num(v, false, 16, *f == 'X', flags, width, prec);
+			break;
+		case 'p':
+			ax_print_num((uint32_t) v, false, 16, false, flags | AX_FMT_ALT, width, prec);
+			break;
+		case 'c':
+			ax_pad(' ', (flags & AX_FMT_LEFT) ? 0 : width - 1);
+			gdb_console_char(v);
+			ax_pad(' ', (flags & AX_FMT_LEFT) ? width - 1 : 0);
+			break;
+		case 's':
+			ax_print_str(v, flags, width, prec);
+			break;
+		default:
+			// Unsupported conversion, print it as is
+			gdb_console_char('%');
+			gdb_console_char(*f);
+			break;
+		}
+	}
+
+	gdb_packet_end();
+}
+
+static bool ax_eval(const uint8_t * code, size_t len, int64_t * result) {
+	int64_t stack[GDBSTUB_AX_STACK];
+	size_t sp = 0;
+	size_t pc = 0;
+	bool ok = true;
+
+	// Stack effect checks: 'need' values have to be on the stack, 'push'
+	// more fit on it.
+#define NEED(n)	do { if (sp < (n)) return false; } while (0)
+#define PUSH(v)	do { int64_t v_ = (v); if (sp >= GDBSTUB_AX_STACK) return false; stack[sp++] = v_; } while (0)
+#define TOP		stack[sp - 1]
+#define NEXT	stack[sp - 2]
+
+	for (size_t steps = 0; steps < GDBSTUB_AX_STEPS; steps++) {
+		if (pc >= len) {
+			return false;
+		}
+
+		uint8_t op = code[pc++];
+		uint64_t arg;
+		uint8_t buf[8];
+
+		switch (op) {
+		case ax_op_add:
+			NEED(2); NEXT += TOP; sp--;
+			break;
+		case ax_op_sub:
+			NEED(2); NEXT -= TOP; sp--;
+			break;
+		case ax_op_mul:
+			NEED(2); NEXT *= TOP; sp--;
+			break;
+		case ax_op_div_signed:
+			NEED(2);
+			if (TOP == 0) {
+				return false;
+			}
+			NEXT /= TOP; sp--;
+			break;
+		case ax_op_div_unsigned:
+			NEED(2);
+			if (TOP == 0) {
+				return false;
+			}
+			NEXT = (uint64_t) NEXT / (uint64_t) TOP; sp--;
+			break;
+		case ax_op_rem_signed:
+			NEED(2);
+			if (TOP == 0) {
+				return false;
+			}
+			NEXT %= TOP; sp--;
+			break;
+		case ax_op_rem_unsigned:
+			NEED(2);
+			if (TOP == 0) {
+				return false;
+			}
+			NEXT = (uint64_t) NEXT % (uint64_t) TOP; sp--;
+			break;
+		case ax_op_lsh:
+			NEED(2);
+			if ((uint64_t) TOP >= 64) {
+				return false;
+			}
+			NEXT = (uint64_t) NEXT << TOP; sp--;
+			break;
+		case ax_op_rsh_signed:
+			NEED(2);
+			if ((uint64_t) TOP >= 64) {
+				return false;
+			}
+			NEXT >>= TOP; sp--;
+			break;
+		case ax_op_rsh_unsigned:
+			NEED(2);
+			if ((uint64_t) TOP >= 64) {
+				return false;
+			}
+			NEXT = (uint64_t) NEXT >> TOP; sp--;
+			break;
+		case ax_op_log_not:
+			NEED(1); TOP = !TOP;
+			break;
+		case ax_op_bit_and:
+			NEED(2); NEXT &= TOP; sp--;
+			break;
+		case ax_op_bit_or:
+			NEED(2); NEXT |= TOP; sp--;
+			break;
+		case ax_op_bit_xor:
+			NEED(2); NEXT ^= TOP; sp--;
+			break;
+		case ax_op_bit_not:
+			NEED(1); TOP = ~TOP;
+			break;
+		case ax_op_equal:
+			NEED(2); NEXT = NEXT == TOP; sp--;
+			break;
+		case ax_op_less_signed:
+			NEED(2); NEXT = NEXT < TOP; sp--;
+			break;
+		case ax_op_less_unsigned:
+			NEED(2); NEXT = (uint64_t) NEXT < (uint64_t) TOP; sp--;
+			break;
+		case ax_op_ext:
+			arg = ax_operand(code, len, &pc, 1, &ok);
+			NEED(1);
+			if (arg == 0) {
+				return false;
+			}
+			TOP = ax_sign_extend(TOP, arg);
+			break;
+		case ax_op_zero_ext:
+			arg = ax_operand(code, len, &pc, 1, &ok);
+			NEED(1);
+			if (arg < 64) {
+				TOP &= (1ULL << arg) - 1;
+			}
+			break;
+		case ax_op_ref8:
+		case ax_op_ref16:
+		case ax_op_ref32:
+		case ax_op_ref64:
+			// Target is little endian
+			arg = 1 << (op - ax_op_ref8);
+			NEED(1);
+			if (!gdbstub_mem_read(TOP, buf, arg)) {
+				return false;
+			}
+			TOP = 0;
+			while (arg-- > 0) {
+				TOP = (TOP << 8) | buf[arg];
+			}
+			break;
+		case ax_op_if_goto:
+			arg = ax_operand(code, len, &pc, 2, &ok);
+			NEED(1);
+			if (stack[--sp] != 0) {
+				pc = arg;
+			}
+			break;
+		case ax_op_goto:
+			pc = ax_operand(code, len, &pc, 2, &ok);
+			break;
+		case ax_op_const8:
+		case ax_op_const16:
+		case ax_op_const32:
+		case ax_op_const64:
+			PUSH(ax_operand(code, len, &pc, 1 << (op - ax_op_const8), &ok));
+			break;
+		case ax_op_reg:
+			arg = ax_operand(code, len, &pc, 2, &ok);
+			if (arg >= GDB_REG_COUNT) {
+				return false;
+			}
+			PUSH(gdbstub_reg_get(arg));
+			break;
+		case ax_op_end:
+			*result = sp > 0 ? TOP : 0;
+			return ok;
+		case ax_op_dup:
+			NEED(1); PUSH(TOP);
+			break;
+		case ax_op_pop:
+			NEED(1); sp--;
+			break;
+		case ax_op_swap:
+			NEED(2); arg = TOP; TOP = NEXT; NEXT = arg;
+			break;
+		case ax_op_pick:
+			arg = ax_operand(code, len, &pc, 1, &ok);
+			NEED(arg + 1); PUSH(stack[sp - 1 - arg]);
+			break;
+		case ax_op_rot:
+			// a b c -> c a b, with c on top
+			NEED(3);
+			arg = TOP;
+			TOP = NEXT;
+			NEXT = stack[sp - 3];
+			stack[sp - 3] = arg;
+			break;
+		case ax_op_trace:
+			// Nothing to collect into outside of tracepoints
+			NEED(2); sp -= 2;
+			break;
+		case ax_op_trace_quick:
+			ax_operand(code, len, &pc, 1, &ok);
+			NEED(1);
+			break;
+		case ax_op_trace16:
+			ax_operand(code, len, &pc, 2, &ok);
+			NEED(1);
+			break;
+		case ax_op_tracenz:
+			NEED(2); sp -= 2;
+			break;
+		case ax_op_printf:
+			// nargs, then the format string with a 16-bit length, zero included
+			arg = ax_operand(code, len, &pc, 1, &ok);
+			{
+				size_t slen = ax_operand(code, len, &pc, 2, &ok);
+
+				if (!ok || slen == 0 || pc + slen > len || code[pc + slen - 1] != 0) {
+					return false;
+				}
+
+				// Function and channel are on top of the arguments. There is
+				// only the GDB console to print to.
+				NEED(arg + 2);
+				sp -= arg + 2;
+				ax_printf((const char *) &code[pc], arg, &stack[sp]);
+				pc += slen;
+			}
+			break;
+		default:
+			return false;
+		}
+
+		if (!ok) {
+			return false;
+		}
+	}
+
+#undef NEED
+#undef PUSH
+#undef TOP
+#undef NEXT
+
+	return false;
+}
+
+/*
+ * Evaluate an agent expression against the registers of the stopped task
+ * and target memory. Returns false if the expression could not be
+ * evaluated, otherwise the value left on top of the stack is stored in
+ * result.
+ */
+bool ATTR_GDBFN gdbstub_ax_eval(const uint8_t * code, size_t len, int64_t * result) {
+	uint32_t start = gdbstub_ccount();
+	bool ok = ax_eval(code, len, result);
+
+	gdbstub_ax_ccount = gdbstub_ccount() - start;
+	return ok;
+}
@@ -0,0 +1,16 @@
+/*
+ * gdbstub-ax.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef GDBSTUB_AX_H_
+#define GDBSTUB_AX_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+bool gdbstub_ax_eval(const uint8_t * code, size_t len, int64_t * result);
+
+#endif /* GDBSTUB_AX_H_ */
@@ -0,0 +1,352 @@
+/*
+ * gdbstub-breakpoints.c
+ *
+ *  Created on: Oct 17, 2026
+ *
+ * Breakpoints managed by the stub. For software breakpoints (Z0/z0) GDB
+ * only tells us where a breakpoint goes; saving and restoring the original
+ * instruction happens here, so no memory has to be transferred for it.
+ * The single hardware breakpoint (Z1/z1) is tracked here as well, so both
+ * kinds can be stepped over and carry conditions and commands (dprintf)
+ * evaluated on the target.
+ *
+ * Breakpoints are shared between GDB and the tracepoints: each one records
+ * its owners (BP_OWNER_*) and is only removed when the last one lets go.
+ */
+
+#include "gdbstub.h"
+#include "gdbstub-cfg.h"
+#include "gdbstub-ax.h"
+#include "gdbstub-breakpoints.h"
+#include "gdbstub-entry.h"
+#include "gdbstub-internal.h"
+
+#include <string.h>
+
+// break 0,0 and break.n 0, in memory order
+static const uint8_t break_insn[] = { 0x00, 0x40, 0x00 };
+static const uint8_t break_n_insn[] = { 0x2d, 0xf0 };
+
+static struct {
+	uintptr_t addr;
+	uint8_t len;		// Length of the replaced instruction, 0 when the slot is free
+	uint8_t owners;
+	bool lifted;		// Original instruction is temporarily back in place
+	uint8_t orig[3];
+} sw_breakpoints[GDBSTUB_SW_BREAKPOINTS_MAX] = {{ 0 }};
+
+static struct {
+	uintptr_t addr;
+	uint8_t owners;		// Not set when zero
+	bool lifted;		// Disabled to step over it
+} hw_breakpoint = { 0 };
+
+/*
+ * Breakpoint conditions and commands. Every software breakpoint slot and
+ * the hardware breakpoint ("site") owns a contiguous block of the pool,
+ * holding its agent expressions as a kind byte (BP_AX_*), a 16-bit
+ * big-endian length and the bytecode.
+ */
+#define HW_SITE		GDBSTUB_SW_BREAKPOINTS_MAX
+#define SITE_COUNT	(GDBSTUB_SW_BREAKPOINTS_MAX + 1)
+
+#define BP_AX_HEADER	3
+
+static uint8_t ax_pool[GDBSTUB_BP_AX_POOL];
+static size_t ax_pool_used = 0;
+static struct {
+	uint16_t offset;
+	uint16_t len;
+	bool commands;		// At least one of the expressions is a command
+} ax_blocks[SITE_COUNT] = {{ 0 }};
+
+static int find_breakpoint(uintptr_t addr) {
+	for (size_t i = 0; i < GDBSTUB_SW_BREAKPOINTS_MAX; i++) {
+		if (sw_breakpoints[i].len != 0 && sw_breakpoints[i].addr == addr) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static bool insert_breakpoint(size_t i) {
+	const uint8_t * insn = sw_breakpoints[i].len == 2 ? break_n_insn : break_insn;
+
+	return gdbstub_mem_write(sw_breakpoints[i].addr, insn, sw_breakpoints[i].len);
+}
+
+/*
+ * 'kind' is the length of the instruction GDB wants to be replaced:
+ * 2 for a narrow instruction (break.n is used), 3 otherwise.
+ */
+bool ATTR_GDBFN gdbstub_sw_breakpoint_set(uintptr_t addr, size_t kind, uint8_t owner) {
+	int slot = find_breakpoint(addr);
+
+	if (slot >= 0) {
+		sw_breakpoints[slot].owners |= owner;
+		return true;
+	}
+
+	if (kind != 2 && kind != 3) {
+		return false;
+	}
+
+	for (size_t i = 0; i < GDBSTUB_SW_BREAKPOINTS_MAX; i++) {
+		if (sw_breakpoints[i].len == 0) {
+			slot = i;
+			break;
+		}
+	}
+
+	if (slot < 0 || !gdbstub_mem_read(addr, sw_breakpoints[slot].orig, kind)) {
+		return false;
+	}
+
+	sw_breakpoints[slot].addr = addr;
+	sw_breakpoints[slot].len = kind;
+	sw_breakpoints[slot].owners = owner;
+	sw_breakpoints[slot].lifted = false;
+
+	if (!insert_breakpoint(slot)) {
+		// Code in flash, only a hardware breakpoint can help there
+		sw_breakpoints[slot].len = 0;
+		return false;
+	}
+
+	return true;
+}
+
+bool ATTR_GDBFN gdbstub_sw_breakpoint_del(uintptr_t addr, uint8_t owner) {
+	int i = find_breakpoint(addr);
+
+	if (i < 0 || !(sw_breakpoints[i].owners & owner)) {
+		return false;
+	}
+
+	if (owner & BP_OWNER_GDB) {
+		gdbstub_breakpoint_ax_clear(i);
+	}
+
+	sw_breakpoints[i].owners &= ~owner;
+
+	if (sw_breakpoints[i].owners != 0) {
+		return true;
+	}
+
+	if (!sw_breakpoints[i].lifted) {
+		gdbstub_mem_write(addr, sw_breakpoints[i].orig, sw_breakpoints[i].len);
+	}
+
+	sw_breakpoints[i].len = 0;
+	return true;
+}
+
+bool ATTR_GDBFN gdbstub_hw_breakpoint_set(uintptr_t addr, uint8_t owner) {
+	if (hw_breakpoint.owners != 0) {
+		// Setting it again only adds an owner or updates the conditions
+		if (hw_breakpoint.addr != addr) {
+			return false;
+		}
+
+		hw_breakpoint.owners |= owner;
+		return true;
+	}
+
+	if (!gdbstub_set_hw_breakpoint(addr, 1)) {
+		return false;
+	}
+
+	hw_breakpoint.addr = addr;
+	hw_breakpoint.owners = owner;
+	hw_breakpoint.lifted = false;
+	return true;
+}
+
+bool ATTR_GDBFN gdbstub_hw_breakpoint_del(uintptr_t addr, uint8_t owner) {
+	if (!(hw_breakpoint.owners & owner) || hw_breakpoint.addr != addr) {
+		return false;
+	}
+
+	if (owner & BP_OWNER_GDB) {
+		gdbstub_breakpoint_ax_clear(HW_SITE);
+	}
+
+	hw_breakpoint.owners &= ~owner;
+
+	if (hw_breakpoint.owners == 0 && !hw_breakpoint.lifted) {
+		gdbstub_del_hw_breakpoint(addr);
+	}
+
+	return true;
+}
+
+/*
+ * Get rid of the breakpoint at addr, if any, so execution can resume from
+ * there. Returns true if there was one; it is inserted again by
+ * gdbstub_breakpoint_restore().
+ */
+bool ATTR_GDBFN gdbstub_breakpoint_lift(uintptr_t addr) {
+	int i = find_breakpoint(addr);
+
+	if (i >= 0 && !sw_breakpoints[i].lifted) {
+		gdbstub_mem_write(addr, sw_breakpoints[i].orig, sw_breakpoints[i].len);
+		sw_breakpoints[i].lifted = true;
+		return true;
+	}
+
+	if (hw_breakpoint.owners != 0 && !hw_breakpoint.lifted && hw_breakpoint.addr == addr) {
+		gdbstub_del_hw_breakpoint(addr);
+		hw_breakpoint.lifted = true;
+		return true;
+	}
+
+	return false;
+}
+
+// Insert lifted breakpoints again. Returns true if there were any.
+bool ATTR_GDBFN gdbstub_breakpoint_restore() {
+	bool restored = false;
+
+	for (size_t i = 0; i < GDBSTUB_SW_BREAKPOINTS_MAX; i++) {
+		if (sw_breakpoints[i].len != 0 && sw_breakpoints[i].lifted) {
+			insert_breakpoint(i);
+			sw_breakpoints[i].lifted = false;
+			restored = true;
+		}
+	}
+
+	if (hw_breakpoint.owners != 0 && hw_breakpoint.lifted) {
+		gdbstub_set_hw_breakpoint(hw_breakpoint.addr, 1);
+		hw_breakpoint.lifted = false;
+		restored = true;
+	}
+
+	return restored;
+}
+
+// Find the site of the breakpoint at addr, -1 if there is none.
+int ATTR_GDBFN gdbstub_breakpoint_site(uintptr_t addr, bool hw) {
+	if (hw) {
+		return hw_breakpoint.owners != 0 && hw_breakpoint.addr == addr ? HW_SITE : -1;
+	}
+
+	return find_breakpoint(addr);
+}
+
+void ATTR_GDBFN gdbstub_breakpoint_ax_clear(int site) {
+	size_t offset = ax_blocks[site].offset;
+	size_t len = ax_blocks[site].len;
+
+	if (len == 0) {
+		return;
+	}
+
+	memmove(&ax_pool[offset], &ax_pool[offset + len], ax_pool_used - offset - len);
+	ax_pool_used -= len;
+
+	for (size_t i = 0; i < SITE_COUNT; i++) {
+		if (ax_blocks[i].len != 0 && ax_blocks[i].offset > offset) {
+			ax_blocks[i].offset -= len;
+		}
+	}
+
+	ax_blocks[site].len = 0;
+	ax_blocks[site].commands = false;
+}
+
+/*
+ * Add a condition or command to a site. Expressions of a site are added
+ * right after clearing it, so its block is always the last one in the pool.
+ */
+bool ATTR_GDBFN gdbstub_breakpoint_ax_add(int site, int kind, const uint8_t * code, size_t len) {
+	if (ax_pool_used + len + BP_AX_HEADER > GDBSTUB_BP_AX_POOL) {
+		return false;
+	}
+
+	if (ax_blocks[site].len == 0) {
+		ax_blocks[site].offset = ax_pool_used;
+	} else if (ax_blocks[site].offset + ax_blocks[site].len != ax_pool_used) {
+		return false;
+	}
+
+	ax_pool[ax_pool_used++] = kind;
+	ax_pool[ax_pool_used++] = len >> 8;
+	ax_pool[ax_pool_used++] = len & 0xff;
+	memcpy(&ax_pool[ax_pool_used], code, len);
+	ax_pool_used += len;
+	ax_blocks[site].len += len + BP_AX_HEADER;
+	ax_blocks[site].commands |= kind == BP_AX_COMMAND;
+
+	return true;
+}
+
+// Whether any condition of the site is true or can't be evaluated, or
+// there are none at all.
+static bool conditions_true(int site) {
+	const uint8_t * p = &ax_pool[ax_blocks[site].offset];
+	const uint8_t * end = p + ax_blocks[site].len;
+	bool any = false;
+
+	for (; p < end; p += ((p[1] << 8) | p[2]) + BP_AX_HEADER) {
+		int64_t result;
+
+		if (p[0] != BP_AX_CONDITION) {
+			continue;
+		}
+
+		if (!gdbstub_ax_eval(p + BP_AX_HEADER, (p[1] << 8) | p[2], &result) || result != 0) {
+			return true;
+		}
+
+		any = true;
+	}
+
+	return !any;
+}
+
+static void run_commands(int site) {
+	const uint8_t * p = &ax_pool[ax_blocks[site].offset];
+	const uint8_t * end = p + ax_blocks[site].len;
+
+	for (; p < end; p += ((p[1] << 8) | p[2]) + BP_AX_HEADER) {
+		int64_t result;
+
+		if (p[0] == BP_AX_COMMAND) {
+			gdbstub_ax_eval(p + BP_AX_HEADER, (p[1] << 8) | p[2], &result);
+		}
+	}
+}
+
+/*
+ * Handle a hit of the breakpoint at addr: returns true if it has to be
+ * reported to GDB. That is the case if any of its conditions is true or
+ * can't be evaluated, or if it has none - unless the breakpoint has
+ * commands, like a dprintf. These are run on the target instead and
+ * execution continues. Breakpoints only set for tracepoints are never
+ * reported.
+ */
+bool ATTR_GDBFN gdbstub_breakpoint_check(uintptr_t addr, bool hw) {
+	int site = gdbstub_breakpoint_site(addr, hw);
+
+	if (site < 0) {
+		return true;
+	}
+
+	uint8_t owners = site == HW_SITE ? hw_breakpoint.owners : sw_breakpoints[site].owners;
+
+	if (!(owners & BP_OWNER_GDB)) {
+		return false;
+	}
+
+	if (!conditions_true(site)) {
+		return false;
+	}
+
+	if (!ax_blocks[site].commands) {
+		return true;
+	}
+
+	run_commands(site);
+	return false;
+}
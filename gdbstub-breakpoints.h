@@ -0,0 +1,34 @@
+/*
+ * gdbstub-breakpoints.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef GDBSTUB_BREAKPOINTS_H_
+#define GDBSTUB_BREAKPOINTS_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Who a breakpoint is set for
+#define BP_OWNER_GDB	(1 << 0)
+#define BP_OWNER_TRACE	(1 << 1)
+
+// Kinds of agent expressions attached to a breakpoint
+#define BP_AX_CONDITION	0
+#define BP_AX_COMMAND	1
+
+bool gdbstub_sw_breakpoint_set(uintptr_t addr, size_t kind, uint8_t owner);
+bool gdbstub_sw_breakpoint_del(uintptr_t addr, uint8_t owner);
+bool gdbstub_hw_breakpoint_set(uintptr_t addr, uint8_t owner);
+bool gdbstub_hw_breakpoint_del(uintptr_t addr, uint8_t owner);
+bool gdbstub_breakpoint_lift(uintptr_t addr);
+bool gdbstub_breakpoint_restore();
+
+int gdbstub_breakpoint_site(uintptr_t addr, bool hw);
+void gdbstub_breakpoint_ax_clear(int site);
+bool gdbstub_breakpoint_ax_add(int site, int kind, const uint8_t * code, size_t len);
+bool gdbstub_breakpoint_check(uintptr_t addr, bool hw);
+
+#endif /* GDBSTUB_BREAKPOINTS_H_ */
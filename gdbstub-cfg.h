@@ -15,12 +15,194 @@
 #endif
 
 /*
- * Max number of tasks gdbstub will be able to handle. Each task descriptor
- * takes 8 bytes of memory. The task descriptor array is allocated
- * statically.
+ * Max number of tasks gdbstub will be able to handle, must be a power of 2
+ * up to 128. Each task takes 7 bytes of memory. Tasks beyond that are not
+ * shown to GDB.
  */
 #ifndef GDBSTUB_THREADS_MAX
-#define GDBSTUB_THREADS_MAX 10
+#define GDBSTUB_THREADS_MAX 32
+#endif
+
+/*
+ * Offer GDB the thread list as XML (qXfer:threads:read), names included.
+ * When disabled, GDB lists threads with qfThreadInfo/qsThreadInfo, a few
+ * bytes per task, and asks for names with qThreadExtraInfo when it shows
+ * them.
+ */
+#ifndef GDBSTUB_THREADS_XML
+#define GDBSTUB_THREADS_XML 1
+#endif
+
+/*
+ * Size of the buffer the thread list XML for GDB is kept in. A task takes
+ * about 25 bytes plus the length of its name. Tasks that don't fit are not
+ * shown to GDB.
+ */
+#ifndef GDBSTUB_THREADS_XML_LEN
+#define GDBSTUB_THREADS_XML_LEN (48 * GDBSTUB_THREADS_MAX)
+#endif
+
+/*
+ * Number of monitor commands the application can register with
+ * gdbstub_monitor_register(). Each entry takes 12 bytes.
+ */
+#ifndef GDBSTUB_MONITOR_MAX
+#define GDBSTUB_MONITOR_MAX 8
+#endif
+
+/*
+ * Number of tasks whose CPU time is accounted for, must be a power of 2.
+ * Each entry takes 16 bytes. Accounting needs the FreeRTOS trace hook,
+ * see README.md.
+ */
+#ifndef GDBSTUB_TASK_STATS_MAX
+#define GDBSTUB_TASK_STATS_MAX 16
+#endif
+
+/*
+ * Number of software breakpoints (Z0) the stub keeps track of. Each entry
+ * takes 12 bytes. Software breakpoints only work on code in RAM.
+ */
+#ifndef GDBSTUB_SW_BREAKPOINTS_MAX
+#define GDBSTUB_SW_BREAKPOINTS_MAX 16
+#endif
+
+/*
+ * Bytes of memory shared by the conditions and commands (dprintf) of all
+ * breakpoints. Each expression takes its bytecode length plus 3 bytes.
+ */
+#ifndef GDBSTUB_BP_AX_POOL
+#define GDBSTUB_BP_AX_POOL 256
+#endif
+
+/*
+ * Depth of the stack used to evaluate breakpoint conditions. It lives on
+ * the exception stack, each entry takes 8 bytes.
+ */
+#ifndef GDBSTUB_AX_STACK
+#define GDBSTUB_AX_STACK 16
+#endif
+
+/*
+ * Max number of bytecode instructions executed for one condition, so a
+ * looping expression can't hang the target. A condition that hits the
+ * limit counts as true and the breakpoint is reported.
+ */
+#ifndef GDBSTUB_AX_STEPS
+#define GDBSTUB_AX_STEPS 256
+#endif
+
+/*
+ * Size of the RAM ring buffer holding the frames collected at tracepoints.
+ * A frame with registers takes 93 bytes, collected memory takes its size
+ * plus 7 bytes per range.
+ */
+#ifndef GDBSTUB_TRACE_BUFLEN
+#define GDBSTUB_TRACE_BUFLEN 2048
+#endif
+
+/*
+ * Number of tracepoints and of collect actions per tracepoint. Each
+ * tracepoint takes 32 bytes plus 12 bytes per action.
+ */
+#ifndef GDBSTUB_TRACEPOINTS_MAX
+#define GDBSTUB_TRACEPOINTS_MAX 8
+#endif
+
+#ifndef GDBSTUB_TRACE_ACTIONS_MAX
+#define GDBSTUB_TRACE_ACTIONS_MAX 4
+#endif
+
+/*
+ * Enable the sampling profiler. It takes the FRC1 timer, which can't be
+ * used by the application then, and records the interrupted pc (and the
+ * current task when GDBSTUB_THREAD_AWARE is set) GDBSTUB_PROFILE_HZ times
+ * per second. The last GDBSTUB_PROFILE_SAMPLES samples are kept, each one
+ * takes 4 bytes, 8 with the task.
+ */
+#ifndef GDBSTUB_PROFILE
+#define GDBSTUB_PROFILE 0
+#endif
+
+#ifndef GDBSTUB_PROFILE_HZ
+#define GDBSTUB_PROFILE_HZ 1000
+#endif
+
+#ifndef GDBSTUB_PROFILE_SAMPLES
+#define GDBSTUB_PROFILE_SAMPLES 1024
+#endif
+
+/*
+ * Size of the command input buffer. The size is reported to GDB as
+ * PacketSize, so it bounds how much memory a single m/M/x/X packet can
+ * transfer. Larger values mean fewer packets (and fewer checksums, acks
+ * and turnarounds) for big transfers at the expense of RAM; values up to
+ * 4096 are reasonable. Has to fit a G packet, i.e. at least 192 bytes.
+ */
+#ifndef GDBSTUB_PBUFLEN
+#define GDBSTUB_PBUFLEN 1024
+#endif
+
+/*
+ * Size of the transmit ring buffer. Outgoing packets are assembled here
+ * and moved to the UART FIFO in bursts instead of polling the FIFO for
+ * every byte. Has to be a power of two.
+ */
+#ifndef GDBSTUB_TX_BUFLEN
+#define GDBSTUB_TX_BUFLEN 256
+#endif
+
+/*
+ * Size of the receive ring buffer the UART interrupt moves bytes from GDB
+ * into while the target runs, so nothing that arrives before the stub
+ * takes over is lost. Has to be a power of two.
+ */
+#ifndef GDBSTUB_RX_BUFLEN
+#define GDBSTUB_RX_BUFLEN 256
+#endif
+
+/*
+ * Size of the ring buffer for UART input that isn't meant for GDB. The
+ * application reads it through stdin. Has to be a power of two.
+ */
+#ifndef GDBSTUB_STDIN_BUFLEN
+#define GDBSTUB_STDIN_BUFLEN 128
+#endif
+
+/*
+ * Size of the ring buffer console output (stdout) is collected in before
+ * it is sent as O packets. Has to be a power of two.
+ */
+#ifndef GDBSTUB_CONSOLE_BUFLEN
+#define GDBSTUB_CONSOLE_BUFLEN 512
+#endif
+
+/*
+ * Console output is sent right away while the UART is idle. While it is
+ * busy, output is collected until a line ends or this many bytes are
+ * pending, and the TX interrupt sends whatever accumulated in the meantime.
+ */
+#ifndef GDBSTUB_CONSOLE_FLUSH
+#define GDBSTUB_CONSOLE_FLUSH 64
+#endif
+
+/*
+ * What writing to a full console buffer does: 1 waits until the UART made
+ * room, 0 drops the bytes that don't fit and counts them in
+ * gdbstub_console_dropped.
+ */
+#ifndef GDBSTUB_CONSOLE_BLOCK
+#define GDBSTUB_CONSOLE_BLOCK 0
+#endif
+
+/*
+ * Drain the transmit buffer from the UART "TX FIFO empty" interrupt while
+ * the target is running, so console output doesn't block the calling task
+ * until the last byte is on the wire. When disabled, output is flushed
+ * synchronously.
+ */
+#ifndef GDBSTUB_TX_INTERRUPT
+#define GDBSTUB_TX_INTERRUPT 1
 #endif
 
 #define ATTR_GDBINIT
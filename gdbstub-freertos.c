@@ -16,13 +16,26 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+
+/*
+ * Tasks keep their slot, and so their GDB thread ID (slot + 1), for as long
+ * as they exist. task_hash maps a TCB to slot + 1 and is rebuilt along with
+ * the slots.
+ */
+#define TASK_HASH_SIZE (2 * GDBSTUB_THREADS_MAX)
+
+#if (GDBSTUB_THREADS_MAX & (GDBSTUB_THREADS_MAX - 1)) != 0 || GDBSTUB_THREADS_MAX > 128
+#error "GDBSTUB_THREADS_MAX must be a power of 2, 128 at most"
+#endif
 
-static size_t task_count = 0;
 static size_t task_selected = 0;
-static struct {
-	uint32_t * stack;
-	TaskHandle_t handle;
-} task_list[GDBSTUB_THREADS_MAX] = {{ 0 }};
+static TaskHandle_t task_list[GDBSTUB_THREADS_MAX] = { 0 };
+static uint8_t task_hash[TASK_HASH_SIZE] = { 0 };
+static bool task_seen[GDBSTUB_THREADS_MAX];
+static bool task_list_valid = false;
+static UBaseType_t task_generation;
+static UBaseType_t task_count;
 
 /*
  * tskTCB is private, so, unfortunately, we have
@@ -53,130 +66,616 @@ extern List_t xSuspendedTaskList;
 
 extern tskTCB * volatile pxCurrentTCB;
 
-static void gdbstub_send_task(size_t id, char * name) {
-	char thread_entry[100] = { 0 };
-	const char * thread_template = "<thread id=\"%x\" core=\"0\" name=\"%s\"></thread>";
+// Incremented by FreeRTOS whenever a task is created or deleted
+extern UBaseType_t uxTaskNumber;
+
+// Also goes down when the idle task frees a task that deleted itself,
+// which uxTaskNumber doesn't notice
+extern volatile UBaseType_t uxCurrentNumberOfTasks;
+
+#if GDBSTUB_THREADS_XML
+/*
+ * The qXfer:threads:read object, built when it is first requested after
+ * the task slots changed and served from here in as many windows as GDB
+ * asks for.
+ */
+static char task_xml[GDBSTUB_THREADS_XML_LEN];
+static size_t task_xml_len = 0;
+static bool task_xml_valid = false;
+
+// Append a string to task_xml, escaping it as XML attribute value if asked
+// to. Returns false when it doesn't fit into the first 'limit' bytes.
+static bool task_xml_append(const char * c, bool escape, size_t limit) {
+	for (; *c != 0; c++) {
+		const char * s = NULL;
+
+		if (escape) {
+			switch (*c) {
+			case '<': s = "&lt;"; break;
+			case '>': s = "&gt;"; break;
+			case '&': s = "&amp;"; break;
+			case '"': s = "&quot;"; break;
+			}
+		}
+
+		size_t len = s != NULL ? strlen(s) : 1;
+
+		if (task_xml_len + len > limit) {
+			return false;
+		}
+
+		memcpy(&task_xml[task_xml_len], s != NULL ? s : c, len);
+		task_xml_len += len;
+	}
 
-	snprintf(thread_entry, sizeof(thread_entry), thread_template, id, name);
-	gdb_packet_str(thread_entry);
+	return true;
 }
 
-static void process_task_list(List_t * list) {
+static void task_xml_fill() {
+	const char * xml_end = "</threads>";
+	size_t limit = sizeof(task_xml) - strlen(xml_end);
+
+	task_xml_len = 0;
+	task_xml_append("<?xml version=\"1.0\" ?><threads>", false, limit);
+
+	/*
+	 * Thread ID 0 has a special meaning in the remote
+	 * protocol and so is avoided. Tasks that don't fit
+	 * are left out as a whole.
+	 */
+	for (size_t i = 0; i < GDBSTUB_THREADS_MAX; i++) {
+		char id[32];
+		size_t entry_start = task_xml_len;
+
+		if (task_list[i] == NULL) {
+			continue;
+		}
+
+		snprintf(id, sizeof(id), "<thread id=\"%x\" name=\"", (unsigned int) i + 1);
+
+		if (!task_xml_append(id, false, limit)
+			|| !task_xml_append(pcTaskGetName(task_list[i]), true, limit)
+			|| !task_xml_append("\"/>", false, limit)) {
+			task_xml_len = entry_start;
+			break;
+		}
+	}
+
+	task_xml_append(xml_end, false, sizeof(task_xml));
+	task_xml_valid = true;
+}
+
+#endif
+
+static size_t task_hash_slot(TaskHandle_t handle) {
+	return (((uint32_t) handle >> 2) * 2654435761u) >> 16;
+}
+
+// Slot of a task, -1 when it isn't listed.
+static int task_find(TaskHandle_t handle) {
+	size_t i = task_hash_slot(handle);
+
+	for (size_t n = 0; n < TASK_HASH_SIZE; n++, i++) {
+		i &= TASK_HASH_SIZE - 1;
+
+		if (task_hash[i] == 0) {
+			return -1;
+		}
+
+		if (task_list[task_hash[i] - 1] == handle) {
+			return task_hash[i] - 1;
+		}
+	}
+
+	return -1;
+}
+
+static void task_hash_add(size_t slot) {
+	size_t i = task_hash_slot(task_list[slot]) & (TASK_HASH_SIZE - 1);
+
+	// The table is twice the size of the list, there always is a free entry
+	while (task_hash[i] != 0) {
+		i = (i + 1) & (TASK_HASH_SIZE - 1);
+	}
+
+	task_hash[i] = slot + 1;
+}
+
+/*
+ * First pass (add false): mark the listed tasks that still exist.
+ * Second pass (add true): give new tasks a free slot, as long as there is
+ * one left.
+ */
+static void process_task_list(List_t * list, bool add) {
 	volatile tskTCB * next_tcb, * first_tcb;
 
 	if (list->uxNumberOfItems > 0) {
 		listGET_OWNER_OF_NEXT_ENTRY(first_tcb, list);
 
 		do {
-			if (task_count > GDBSTUB_THREADS_MAX) {
-				break;
-			}
-
 			listGET_OWNER_OF_NEXT_ENTRY(next_tcb, list);
 
-			task_list[task_count].stack = (uint32_t *) next_tcb->pxTopOfStack;
-			task_list[task_count].handle = (TaskHandle_t) next_tcb;
+			TaskHandle_t handle = (TaskHandle_t) next_tcb;
+			int slot = task_find(handle);
+
+			if (!add) {
+				if (slot >= 0) {
+					task_seen[slot] = true;
+				}
+			} else if (slot < 0) {
+				for (slot = 0; slot < GDBSTUB_THREADS_MAX && task_list[slot] != NULL; slot++);
 
-			task_count++;
+				if (slot < GDBSTUB_THREADS_MAX) {
+					task_list[slot] = handle;
+					task_hash_add(slot);
+				}
+			}
 		} while (next_tcb != first_tcb);
 	}
 }
 
-static void fill_task_array() {
+static void process_all_task_lists(bool add) {
 	int32_t queue = configMAX_PRIORITIES;
 
-	task_count = 0;
-
 	do {
 		queue--;
-		process_task_list(&pxReadyTasksLists[queue]);
+		process_task_list(&pxReadyTasksLists[queue], add);
 	} while (queue > tskIDLE_PRIORITY);
 
-	process_task_list((List_t *) pxDelayedTaskList);
-	process_task_list((List_t *) pxOverflowDelayedTaskList);
+	process_task_list((List_t *) pxDelayedTaskList, add);
+	process_task_list((List_t *) pxOverflowDelayedTaskList, add);
 
 #if INCLUDE_vTaskDelete
-	process_task_list(&xTasksWaitingTermination);
+	process_task_list(&xTasksWaitingTermination, add);
 #endif
 
 #if INCLUDE_vTaskSuspend
-	process_task_list(&xSuspendedTaskList);
+	process_task_list(&xSuspendedTaskList, add);
 #endif
 }
 
-void gdbstub_freertos_task_list() {
-	gdb_packet_start();
-	gdb_packet_str("l");
-	gdb_packet_str("<?xml version=\"1.0\" ?>");
-	gdb_packet_str("<threads>");
+static void stats_prune();
 
-	/*
-	 * It is assumed that the task array doesn't need
-	 * to be updated because it already was when the
-	 * stop reason was reported.
-	 *
-	 * Thread ID 0 has a special meaning in the remote
-	 * protocol and so is avoided.
-	 */
+/*
+ * Bring the task slots up to date. The lists are only walked when tasks
+ * were created, deleted or freed since the last time.
+ */
+static void fill_task_array() {
+	if (task_list_valid && task_generation == uxTaskNumber && task_count == uxCurrentNumberOfTasks) {
+		return;
+	}
+
+	memset(task_seen, 0, sizeof(task_seen));
+	process_all_task_lists(false);
+
+	memset(task_hash, 0, sizeof(task_hash));
 
-	for (size_t i = 0; i < task_count - 1; i++) {
-		gdbstub_send_task(i + 1, (char *) pcTaskGetName(task_list[i].handle));
+	for (size_t slot = 0; slot < GDBSTUB_THREADS_MAX; slot++) {
+		if (!task_seen[slot]) {
+			task_list[slot] = NULL;
+		} else {
+			task_hash_add(slot);
+		}
 	}
+	process_all_task_lists(true);
+	stats_prune();
+
+	task_generation = uxTaskNumber;
+	task_count = uxCurrentNumberOfTasks;
+	task_list_valid = true;
+#if GDBSTUB_THREADS_XML
+	task_xml_valid = false;
+#endif
+}
 
-	gdb_packet_str("</threads>");
-	gdb_packet_end();
+// Called whenever the target stops, before GDB gets to ask about threads.
+void gdbstub_freertos_task_refresh() {
+	fill_task_array();
 }
 
+#if GDBSTUB_THREADS_XML
+/*
+ * qXfer:threads:read object generator, see gdb_xfer_reply(). The task
+ * array is up to date, it was refreshed when the target stopped.
+ */
+void gdbstub_freertos_task_list() {
+	if (!task_xml_valid) {
+		task_xml_fill();
+	}
+
+	gdb_xfer_data(task_xml, task_xml_len);
+}
+#endif
+
 void gdbstub_freertos_task_select(size_t gdb_task_index) {
 	task_selected = gdb_task_index - 1;
 }
 
 bool gdbstub_freertos_task_selected() {
-	if (task_selected > task_count - 1) {
+	if (task_selected >= GDBSTUB_THREADS_MAX || task_list[task_selected] == NULL) {
 		return true;
 	}
 
-	return task_list[task_selected].handle == (TaskHandle_t) pxCurrentTCB;
+	return task_list[task_selected] == (TaskHandle_t) pxCurrentTCB;
 }
 
-void gdbstub_freertos_regs_read() {
+/*
+ * Layout of the context a task that isn't running saved on its stack: the
+ * interrupt frame of the esp8266 port (XT_STK_* in xtensa_context.h), in
+ * words from pxTopOfStack. Registers at -1 aren't part of the task context,
+ * they are the same for all tasks and are taken from the live state.
+ */
+static const int8_t task_frame[GDB_REG_COUNT] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,	// a0 - a15
+	1,		// pc
+	19,		// sar
+	-1,		// litbase
+	-1,		// sr176
+	-1,		// sr208
+	2,		// ps
+};
+
+// Where a register of the selected task is saved, NULL if it isn't.
+static uint32_t * task_reg_ptr(size_t regnum) {
 	// task_selected was checked before
-	gdb_packet_start();
+	uint32_t * task_regs = (uint32_t *) ((tskTCB *) task_list[task_selected])->pxTopOfStack;
 
-	uint32_t * task_regs = task_list[task_selected].stack;
+	return task_frame[regnum] >= 0 ? &task_regs[task_frame[regnum]] : NULL;
+}
 
-	for (size_t i = 3; i <= 18; i++) {
-		gdb_packet_hex(bswap32(task_regs[i]), 32);
+bool gdbstub_freertos_reg_read(size_t regnum, uint32_t * val) {
+	if (regnum >= GDB_REG_COUNT) {
+		return false;
 	}
 
-	// pc
-	gdb_packet_hex(bswap32(task_regs[1]), 32);
+	uint32_t * reg = task_reg_ptr(regnum);
+
+	*val = reg != NULL ? *reg : gdbstub_reg_get(regnum);
+	return true;
+}
+
+void gdbstub_freertos_regs_read() {
+	uint32_t val;
 
-	// Skip special registers
-	gdb_packet_hex(0, 32);
-	gdb_packet_hex(0, 32);
-	gdb_packet_hex(0, 32);
-	gdb_packet_hex(0, 32);
+	gdb_packet_start();
 
-	// ps
-	gdb_packet_hex(task_regs[2], 32);
+	for (size_t i = 0; i < GDB_REG_COUNT; i++) {
+		gdbstub_freertos_reg_read(i, &val);
+		gdb_packet_hex(bswap32(val), 32);
+	}
 
 	gdb_packet_end();
 }
 
+bool gdbstub_freertos_reg_write(size_t regnum, uint32_t val) {
+	if (regnum >= GDB_REG_COUNT) {
+		return false;
+	}
+
+	uint32_t * reg = task_reg_ptr(regnum);
+
+	if (reg != NULL) {
+		*reg = val;
+	} else {
+		gdbstub_reg_set(regnum, val);
+	}
+
+	return true;
+}
+
 void gdbstub_freertos_report_thread() {
 	fill_task_array();
 
-	size_t task_index = 0;
+	int slot = task_find((TaskHandle_t) pxCurrentTCB);
 
-	for (size_t i = 0; i < task_count - 1; i++) {
-		if (task_list[i].handle == (TaskHandle_t) pxCurrentTCB) {
-			task_index = i;
-			break;
-		}
+	// The running task may not have found a free slot
+	if (slot < 0) {
+		return;
 	}
 
 	gdb_packet_str("thread:");
-	gdb_packet_hex(task_index + 1, 8);
+	gdb_packet_hex(slot + 1, 8);
 	gdb_packet_str(";");
 }
+
+/*
+ * Handle and name of the task in slot i, as of when the stop was
+ * reported. The handle is 0 for a free slot. Returns false past the last
+ * slot.
+ */
+bool gdbstub_freertos_task_info(size_t i, uint32_t * handle, const char ** name) {
+	if (i >= GDBSTUB_THREADS_MAX) {
+		return false;
+	}
+
+	*handle = (uint32_t) task_list[i];
+	*name = task_list[i] != NULL ? pcTaskGetName(task_list[i]) : "";
+	return true;
+}
+
+/*
+ * Thread listing without names: qfThreadInfo/qsThreadInfo page through the
+ * thread IDs, qThreadExtraInfo sends the name and state of one thread on
+ * demand. Works on the task slots as of the last stop.
+ */
+#define THREAD_INFO_PAGE 32
+
+static size_t thread_info_next = 0;
+
+static void thread_info_page() {
+	size_t sent = 0;
+
+	gdb_packet_start();
+
+	for (; thread_info_next < GDBSTUB_THREADS_MAX && sent < THREAD_INFO_PAGE; thread_info_next++) {
+		if (task_list[thread_info_next] == NULL) {
+			continue;
+		}
+
+		gdb_packet_str(sent++ == 0 ? "m" : ",");
+		gdb_packet_hex(thread_info_next + 1, 8);
+	}
+
+	if (sent == 0) {
+		gdb_packet_str("l");
+	}
+
+	gdb_packet_end();
+}
+
+static void thread_extra_info(size_t id) {
+	TaskHandle_t handle = id - 1 < GDBSTUB_THREADS_MAX ? task_list[id - 1] : NULL;
+	const char * name = "";
+	const char * state = NULL;
+
+	if (handle != NULL) {
+		name = pcTaskGetName(handle);
+#if INCLUDE_eTaskGetState
+		const char * states[] = { "running", "ready", "blocked", "suspended", "deleted" };
+		eTaskState s = eTaskGetState(handle);
+
+		if (s < sizeof(states) / sizeof(states[0])) {
+			state = states[s];
+		}
+#endif
+	}
+
+	gdb_packet_start();
+
+	for (const char * c = name; *c != 0; c++) {
+		gdb_packet_hex(*c, 8);
+	}
+
+	if (state != NULL) {
+		gdb_packet_hex(' ', 8);
+		gdb_packet_hex('(', 8);
+
+		for (const char * c = state; *c != 0; c++) {
+			gdb_packet_hex(*c, 8);
+		}
+
+		gdb_packet_hex(')', 8);
+	}
+
+	gdb_packet_end();
+}
+
+bool gdbstub_freertos_query(uint8_t * query) {
+	if (strcmp((char *) query, "fThreadInfo") == 0) {
+		thread_info_next = 0;
+		thread_info_page();
+	} else if (strcmp((char *) query, "sThreadInfo") == 0) {
+		thread_info_page();
+	} else if (strncmp((char *) query, "ThreadExtraInfo,", 16) == 0) {
+		query += 16;
+		thread_extra_info(gdb_get_hex_val(&query, -1));
+	} else if (strcmp((char *) query, "C") == 0) {
+		int slot = task_find((TaskHandle_t) pxCurrentTCB);
+
+		gdb_packet_start();
+
+		if (slot >= 0) {
+			gdb_packet_str("QC");
+			gdb_packet_hex(slot + 1, 8);
+		}
+
+		gdb_packet_end();
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+// T: whether a thread ID still refers to a task.
+bool gdbstub_freertos_task_alive(size_t id) {
+	return id - 1 < GDBSTUB_THREADS_MAX && task_list[id - 1] != NULL;
+}
+
+/*
+ * CPU time accounting. The traceTASK_SWITCHED_IN hook of FreeRTOS calls
+ * gdbstub_freertos_task_switched_in(), which charges the cycles since the
+ * previous switch to the task that was running. Tasks are found in a small
+ * open addressing hash table keyed by their TCB address.
+ */
+static struct {
+	uint32_t handle;	// Free when 0
+	uint32_t switches;
+	uint64_t cycles;
+} task_stats[GDBSTUB_TASK_STATS_MAX] = {{ 0 }};
+static uint64_t stats_untracked = 0;	// Cycles of tasks that didn't fit into the table or are gone
+static uint32_t stats_untracked_switches = 0;
+static uint64_t stats_total = 0;
+static uint32_t stats_ccount;			// When the running task was switched in
+static uint32_t stats_task = 0;			// The running task, 0 before the first switch
+
+static int stats_find(uint32_t handle, bool add) {
+	size_t i = ((handle >> 2) * 2654435761u) >> 16;
+
+	for (size_t n = 0; n < GDBSTUB_TASK_STATS_MAX; n++, i++) {
+		i &= GDBSTUB_TASK_STATS_MAX - 1;
+
+		if (task_stats[i].handle == handle) {
+			return i;
+		}
+
+		if (task_stats[i].handle == 0) {
+			if (!add) {
+				return -1;
+			}
+
+			task_stats[i].handle = handle;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void stats_charge() {
+	uint32_t now = gdbstub_ccount();
+	uint32_t elapsed = now - stats_ccount;
+
+	stats_ccount = now;
+
+	if (stats_task == 0) {
+		return;
+	}
+
+	int i = stats_find(stats_task, true);
+
+	if (i >= 0) {
+		task_stats[i].cycles += elapsed;
+	} else {
+		stats_untracked += elapsed;
+	}
+
+	stats_total += elapsed;
+}
+
+/*
+ * Fold the entries of tasks that are gone into the untracked totals and
+ * free them, so that new tasks find room and a task that gets the TCB of a
+ * deleted one starts from zero. Entries that can't be reached from their
+ * hash any more because of the holes are moved up.
+ */
+static void stats_prune() {
+	bool moved;
+
+	for (size_t i = 0; i < GDBSTUB_TASK_STATS_MAX; i++) {
+		if (task_stats[i].handle != 0 && task_find((TaskHandle_t) task_stats[i].handle) < 0) {
+			stats_untracked += task_stats[i].cycles;
+			stats_untracked_switches += task_stats[i].switches;
+			memset(&task_stats[i], 0, sizeof(task_stats[i]));
+		}
+	}
+
+	do {
+		moved = false;
+
+		for (size_t i = 0; i < GDBSTUB_TASK_STATS_MAX; i++) {
+			uint32_t handle = task_stats[i].handle;
+
+			if (handle == 0 || stats_find(handle, false) >= 0) {
+				continue;
+			}
+
+			uint32_t switches = task_stats[i].switches;
+			uint64_t cycles = task_stats[i].cycles;
+
+			memset(&task_stats[i], 0, sizeof(task_stats[i]));
+
+			int j = stats_find(handle, true);
+
+			task_stats[j].switches = switches;
+			task_stats[j].cycles = cycles;
+			moved = true;
+		}
+	} while (moved);
+}
+
+void gdbstub_freertos_task_switched_in() {
+	stats_charge();
+
+	if (stats_task != (uint32_t) pxCurrentTCB) {
+		stats_task = (uint32_t) pxCurrentTCB;
+
+		int i = stats_find(stats_task, true);
+
+		if (i >= 0) {
+			task_stats[i].switches++;
+		}
+	}
+}
+
+// Print a line of the task table, cycles out of stats_total.
+static void stats_print(const char * name, uint64_t cycles, uint32_t switches, int stack_free) {
+	char line[64];
+	uint32_t permille = stats_total != 0 ? (cycles * 1000 + stats_total / 2) / stats_total : 0;
+
+	if (stack_free >= 0) {
+		snprintf(line, sizeof(line), "%-16s %3u.%u %10u %10d\n", name,
+			(unsigned int) permille / 10, (unsigned int) permille % 10, (unsigned int) switches, stack_free);
+	} else {
+		snprintf(line, sizeof(line), "%-16s %3u.%u %10u\n", name,
+			(unsigned int) permille / 10, (unsigned int) permille % 10, (unsigned int) switches);
+	}
+
+	gdb_console_str(line);
+}
+
+/*
+ * "monitor tasks": CPU time share, switch count and stack high-water mark
+ * of each task since the start or the last "monitor tasks reset". The
+ * time spent stopped in the debugger counts for the task that was
+ * interrupted.
+ */
+void gdbstub_freertos_monitor_tasks(bool reset) {
+	uint64_t other = stats_untracked;
+	uint32_t other_switches = stats_untracked_switches;
+
+	if (reset) {
+		memset(task_stats, 0, sizeof(task_stats));
+		stats_untracked = 0;
+		stats_untracked_switches = 0;
+		stats_total = 0;
+		stats_ccount = gdbstub_ccount();
+		return;
+	}
+
+	if (stats_task == 0) {
+		gdb_console_str("No task switches seen, is traceTASK_SWITCHED_IN set up?\n");
+		return;
+	}
+
+	stats_charge();
+	gdb_console_str("Task              CPU%   Switches Stack free\n");
+
+	for (size_t i = 0; i < GDBSTUB_THREADS_MAX; i++) {
+		if (task_list[i] == NULL) {
+			continue;
+		}
+
+		int s = stats_find((uint32_t) task_list[i], false);
+		int stack_free = -1;
+
+#if INCLUDE_uxTaskGetStackHighWaterMark
+		stack_free = uxTaskGetStackHighWaterMark(task_list[i]) * sizeof(portSTACK_TYPE);
+#endif
+
+		stats_print(pcTaskGetName(task_list[i]), s >= 0 ? task_stats[s].cycles : 0,
+			s >= 0 ? task_stats[s].switches : 0, stack_free);
+	}
+
+	// Tasks that are gone or didn't fit into the table
+	for (size_t i = 0; i < GDBSTUB_TASK_STATS_MAX; i++) {
+		if (task_stats[i].handle != 0 && task_find((TaskHandle_t) task_stats[i].handle) < 0) {
+			other += task_stats[i].cycles;
+			other_switches += task_stats[i].switches;
+		}
+	}
+
+	if (other != 0) {
+		stats_print("(other)", other, other_switches, -1);
+	}
+}
@@ -10,11 +10,19 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
+void gdbstub_freertos_task_refresh();
 void gdbstub_freertos_task_list();
 void gdbstub_freertos_task_select(size_t gdb_task_index);
 bool gdbstub_freertos_task_selected();
 void gdbstub_freertos_regs_read();
+bool gdbstub_freertos_reg_read(size_t regnum, uint32_t * val);
+bool gdbstub_freertos_reg_write(size_t regnum, uint32_t val);
 void gdbstub_freertos_report_thread();
+bool gdbstub_freertos_query(uint8_t * query);
+bool gdbstub_freertos_task_alive(size_t id);
+bool gdbstub_freertos_task_info(size_t i, uint32_t * handle, const char ** name);
+void gdbstub_freertos_monitor_tasks(bool reset);
 
 #endif /* GDBSTUB_FREERTOS_H_ */
@@ -9,12 +9,57 @@
 #define GDBSTUB_INTERNAL_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 void gdb_packet_start();
 void gdb_packet_char(char c);
 void gdb_packet_str(const char * c);
 void gdb_packet_end();
 void gdb_packet_hex(int val, int bits);
+void gdb_console_start();
+void gdb_console_char(char c);
+void gdb_console_str(const char * c);
+void gdb_console_flush();
+long gdb_get_hex_val(uint8_t ** ptr, size_t bits);
+
+/*
+ * Register numbers used by the lx106 GDB port, in the order of the
+ * g packet (see struct regfile in gdbstub.c).
+ */
+enum {
+	GDB_REG_A0 = 0,
+	GDB_REG_A1 = 1,
+	GDB_REG_A15 = 15,
+	GDB_REG_PC,
+	GDB_REG_SAR,
+	GDB_REG_LITBASE,
+	GDB_REG_SR176,
+	GDB_REG_SR208,
+	GDB_REG_PS,
+	GDB_REG_COUNT
+};
+
+void gdb_xfer_str(const char * c);
+void gdb_xfer_data(const void * data, size_t len);
+void gdb_xfer_reply(void (* fn)(), size_t offset, size_t length);
+
+#define GDBSTUB_MEM_R		(1 << 0)	// Region can be read
+#define GDBSTUB_MEM_W		(1 << 1)	// Region can be written
+#define GDBSTUB_MEM_WORD	(1 << 2)	// Region only decodes 32-bit accesses
+
+struct gdbstub_mem_region {
+	uintptr_t base;
+	size_t size;
+	uint8_t flags;
+};
+
+bool gdbstub_mem_valid(uintptr_t p, size_t len, uint8_t access);
+bool gdbstub_mem_read(uintptr_t p, void * buf, size_t len);
+bool gdbstub_mem_write(uintptr_t p, const void * buf, size_t len);
+
+uint32_t gdbstub_reg_get(size_t regnum);
+void gdbstub_reg_set(size_t regnum, uint32_t val);
 
 static inline uint32_t bswap32(uint32_t i) {
 	uint32_t r;
@@ -25,4 +70,10 @@ static inline uint32_t bswap32(uint32_t i) {
 	return r;
 }
 
+static inline uint32_t gdbstub_ccount() {
+	uint32_t r;
+	__asm volatile ("rsr %0, ccount" : "=r" (r));
+	return r;
+}
+
 #endif /* GDBSTUB_INTERNAL_H_ */
@@ -0,0 +1,151 @@
+/*
+ * gdbstub-monitor.c
+ *
+ *  Created on: Oct 17, 2026
+ *
+ * GDB's "monitor" commands (qRcmd). The command line is split into the
+ * command name, its first word, and the arguments after it. Commands run
+ * while the target is stopped and print to the GDB console; the reply to
+ * qRcmd itself is OK. Besides the built-in commands, the application can
+ * register up to GDBSTUB_MONITOR_MAX of its own.
+ */
+
+#include "gdbstub.h"
+#include "gdbstub-cfg.h"
+#include "gdbstub-monitor.h"
+#include "gdbstub-freertos.h"
+#include "gdbstub-internal.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+struct monitor_cmd {
+	const char * name;
+	bool (* fn)(const char * args);
+	const char * help;
+};
+
+static bool monitor_help(const char * args);
+
+#if GDBSTUB_THREAD_AWARE
+static bool monitor_tasks(const char * args) {
+	gdbstub_freertos_monitor_tasks(strcmp(args, "reset") == 0);
+	return false;
+}
+#endif
+
+static const struct monitor_cmd builtin_cmds[] = {
+	{ "help", monitor_help, "List the monitor commands" },
+	{ "stats", gdbstub_monitor_stats, "Link and command handler statistics, \"stats reset\" clears them" },
+	{ "baud", gdbstub_monitor_baud, "Show the baud rate, \"baud <rate>\" changes it" },
+#if GDBSTUB_THREAD_AWARE
+	{ "tasks", monitor_tasks, "CPU time and stack use of the tasks, \"tasks reset\" clears them" },
+#endif
+};
+
+static struct {
+	const char * name;
+	gdbstub_monitor_fn fn;
+	const char * help;
+} app_cmds[GDBSTUB_MONITOR_MAX];
+
+static bool monitor_help(const char * args) {
+	for (size_t i = 0; i < sizeof(builtin_cmds) / sizeof(builtin_cmds[0]); i++) {
+		gdbstub_monitor_printf("%-8s %s\n", builtin_cmds[i].name, builtin_cmds[i].help);
+	}
+
+	for (size_t i = 0; i < GDBSTUB_MONITOR_MAX && app_cmds[i].name != NULL; i++) {
+		gdbstub_monitor_printf("%-8s %s\n", app_cmds[i].name, app_cmds[i].help != NULL ? app_cmds[i].help : "");
+	}
+
+	return false;
+}
+
+/*
+ * Add a monitor command. Returns false when the name is taken or there is
+ * no room left. The strings are not copied.
+ */
+bool gdbstub_monitor_register(const char * name, gdbstub_monitor_fn fn, const char * help) {
+	size_t i;
+
+	for (i = 0; i < sizeof(builtin_cmds) / sizeof(builtin_cmds[0]); i++) {
+		if (strcmp(builtin_cmds[i].name, name) == 0) {
+			return false;
+		}
+	}
+
+	for (i = 0; i < GDBSTUB_MONITOR_MAX && app_cmds[i].name != NULL; i++) {
+		if (strcmp(app_cmds[i].name, name) == 0) {
+			return false;
+		}
+	}
+
+	if (i == GDBSTUB_MONITOR_MAX) {
+		return false;
+	}
+
+	app_cmds[i].fn = fn;
+	app_cmds[i].help = help;
+	app_cmds[i].name = name;
+	return true;
+}
+
+// Print to the GDB console from a monitor command.
+void gdbstub_monitor_printf(const char * fmt, ...) {
+	char line[128];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	gdb_console_str(line);
+}
+
+// qRcmd: args is the hex encoded command line.
+void ATTR_GDBFN gdbstub_monitor(uint8_t * args) {
+	// Decode the command line in place
+	char * line = (char *) args;
+	size_t len = 0;
+	bool replied = false;
+	bool found = false;
+
+	while (args[0] != 0 && args[1] != 0) {
+		line[len++] = gdb_get_hex_val(&args, 8);
+	}
+
+	line[len] = 0;
+
+	// Split into the name and the arguments
+	size_t name_len = strcspn(line, " ");
+	char * cmd_args = &line[name_len];
+
+	while (*cmd_args == ' ') {
+		*cmd_args++ = 0;
+	}
+
+	for (size_t i = 0; !found && i < sizeof(builtin_cmds) / sizeof(builtin_cmds[0]); i++) {
+		if (strcmp(builtin_cmds[i].name, line) == 0) {
+			replied = builtin_cmds[i].fn(cmd_args);
+			found = true;
+		}
+	}
+
+	for (size_t i = 0; !found && i < GDBSTUB_MONITOR_MAX && app_cmds[i].name != NULL; i++) {
+		if (strcmp(app_cmds[i].name, line) == 0) {
+			app_cmds[i].fn(cmd_args);
+			found = true;
+		}
+	}
+
+	if (!found) {
+		gdb_console_str("Unknown monitor command, see \"monitor help\"\n");
+	}
+
+	if (!replied) {
+		gdb_packet_start();
+		gdb_packet_str("OK");
+		gdb_packet_end();
+	}
+}
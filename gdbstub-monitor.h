@@ -0,0 +1,21 @@
+/*
+ * gdbstub-monitor.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef GDBSTUB_MONITOR_H_
+#define GDBSTUB_MONITOR_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+void gdbstub_monitor(uint8_t * args);
+
+// Built-in commands living elsewhere, they return true when they have sent
+// the reply to qRcmd themselves
+bool gdbstub_monitor_baud(const char * args);
+bool gdbstub_monitor_stats(const char * args);
+
+#endif /* GDBSTUB_MONITOR_H_ */
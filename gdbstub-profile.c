@@ -0,0 +1,155 @@
+/*
+ * gdbstub-profile.c
+ *
+ *  Created on: Oct 17, 2026
+ *
+ * Sampling profiler. The FRC1 timer interrupt records the pc it
+ * interrupted, like the UART handler does for Ctrl-C, into a ring of
+ * GDBSTUB_PROFILE_SAMPLES entries. Code running with interrupts disabled
+ * is never sampled, its time is attributed to the instruction that
+ * re-enables them.
+ *
+ * GDB reads the samples as a binary qXfer object, "profile", all values
+ * little endian:
+ *
+ *	char magic[4];		"GPRF"
+ *	uint16_t version;	1
+ *	uint16_t flags;		bit 0: samples carry the current task
+ *	uint32_t hz;		sampling rate
+ *	uint32_t total;		samples taken, including overwritten ones
+ *	uint32_t count;		samples that follow
+ *	{ uint32_t pc; [uint32_t task;] } samples[count];	oldest first
+ *	uint32_t task_count;	only with flag bit 0
+ *	{ uint32_t handle; char name[16]; } tasks[task_count];
+ *
+ * tools/gdbstub-profile.py turns it into a flat profile.
+ */
+
+#include "gdbstub.h"
+#include "gdbstub-cfg.h"
+#include "gdbstub-profile.h"
+#include "gdbstub-freertos.h"
+#include "gdbstub-internal.h"
+
+#if GDBSTUB_PROFILE
+
+#include <xtensa/config/specreg.h>
+#include <xtensa/config/core-isa.h>
+
+#include <esp/types.h>
+#include <esp/timer.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <string.h>
+
+#define ETS_FRC1_INUM 9
+
+#define PROFILE_TASK_NAME_LEN 16
+
+static uint32_t sample_pc[GDBSTUB_PROFILE_SAMPLES];
+#if GDBSTUB_THREAD_AWARE
+static uint32_t sample_task[GDBSTUB_PROFILE_SAMPLES];
+#endif
+static size_t sample_next = 0;
+
+// Samples taken so far. Set it to 0 from GDB to start over, and clear
+// gdbstub_profile_running to pause sampling.
+uint32_t gdbstub_profile_total = 0;
+bool gdbstub_profile_running = true;
+
+static void ATTR_GDBFN gdbstub_profile_isr() {
+	uint32_t pc;
+
+	__asm volatile (
+		"rsr %0, %1"
+	: "=r" (pc) : "i" (EPC + XCHAL_INT9_LEVEL));
+
+	if (!gdbstub_profile_running) {
+		return;
+	}
+
+	if (gdbstub_profile_total == 0) {
+		sample_next = 0;
+	}
+
+	sample_pc[sample_next] = pc;
+#if GDBSTUB_THREAD_AWARE
+	sample_task[sample_next] = (uint32_t) xTaskGetCurrentTaskHandle();
+#endif
+
+	if (++sample_next == GDBSTUB_PROFILE_SAMPLES) {
+		sample_next = 0;
+	}
+
+	gdbstub_profile_total++;
+}
+
+void ATTR_GDBINIT gdbstub_profile_init() {
+	_xt_isr_attach(ETS_FRC1_INUM, gdbstub_profile_isr, NULL);
+
+	timer_set_frequency(FRC1, GDBSTUB_PROFILE_HZ);
+	timer_set_interrupts(FRC1, true);
+	timer_set_run(FRC1, true);
+
+	uint32_t intenable;
+	__asm volatile (
+		"rsr %0, intenable" "\n"
+		"or %0, %0, %1" "\n"
+		"wsr %0, intenable" "\n"
+	:: "r" (intenable), "r" (BIT(ETS_FRC1_INUM)));
+}
+
+// Generator of the qXfer:profile:read object, see gdb_xfer_reply()
+void ATTR_GDBFN gdbstub_profile_xfer() {
+	size_t count = gdbstub_profile_total < GDBSTUB_PROFILE_SAMPLES
+		? gdbstub_profile_total : GDBSTUB_PROFILE_SAMPLES;
+	size_t i = count < GDBSTUB_PROFILE_SAMPLES ? 0 : sample_next;
+	uint32_t header[5];
+
+	memcpy(&header[0], "GPRF", 4);
+	header[1] = 1 | (GDBSTUB_THREAD_AWARE << 16);
+	header[2] = GDBSTUB_PROFILE_HZ;
+	header[3] = gdbstub_profile_total;
+	header[4] = count;
+	gdb_xfer_data(header, sizeof(header));
+
+	for (size_t n = 0; n < count; n++) {
+		gdb_xfer_data(&sample_pc[i], 4);
+#if GDBSTUB_THREAD_AWARE
+		gdb_xfer_data(&sample_task[i], 4);
+#endif
+
+		if (++i == GDBSTUB_PROFILE_SAMPLES) {
+			i = 0;
+		}
+	}
+
+#if GDBSTUB_THREAD_AWARE
+	// Names of the tasks that exist now
+	uint32_t task_count = 0;
+	uint32_t handle;
+	const char * name;
+
+	for (size_t n = 0; gdbstub_freertos_task_info(n, &handle, &name); n++) {
+		task_count += handle != 0;
+	}
+
+	gdb_xfer_data(&task_count, 4);
+
+	for (size_t n = 0; gdbstub_freertos_task_info(n, &handle, &name); n++) {
+		if (handle == 0) {
+			continue;
+		}
+
+		char padded[PROFILE_TASK_NAME_LEN] = { 0 };
+
+		strncpy(padded, name, sizeof(padded) - 1);
+		gdb_xfer_data(&handle, 4);
+		gdb_xfer_data(padded, sizeof(padded));
+	}
+#endif
+}
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * gdbstub-profile.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef GDBSTUB_PROFILE_H_
+#define GDBSTUB_PROFILE_H_
+
+void gdbstub_profile_init();
+void gdbstub_profile_xfer();
+
+#endif /* GDBSTUB_PROFILE_H_ */
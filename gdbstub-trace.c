@@ -0,0 +1,672 @@
+/*
+ * gdbstub-trace.c
+ *
+ *  Created on: Oct 17, 2026
+ *
+ * Tracepoints. While an experiment is running, hitting a tracepoint
+ * collects registers and memory into a RAM ring buffer of
+ * GDBSTUB_TRACE_BUFLEN bytes and the target continues right away; GDB
+ * looks at the collected frames later (tfind), which serves g, p and m
+ * from the selected frame instead of the live target.
+ *
+ * Supported actions are register (R) and memory (M) collection. Frames
+ * never wrap around the end of the buffer, so each block can be served
+ * straight from it.
+ */
+
+#include "gdbstub.h"
+#include "gdbstub-cfg.h"
+#include "gdbstub-breakpoints.h"
+#include "gdbstub-trace.h"
+#include "gdbstub-internal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_REGS_SIZE		(GDB_REG_COUNT * 4)
+
+// Frame header: 16-bit size including the header, 16-bit tracepoint index
+#define TRACE_FRAME_HEADER	4
+// Block headers: 'R', or 'M' followed by the 32-bit address and 16-bit length
+#define TRACE_REGS_HEADER	1
+#define TRACE_MEM_HEADER	7
+
+struct trace_action {
+	char type;			// 'R' or 'M'
+	int8_t basereg;		// M: address is relative to this register, -1 if absolute
+	uint32_t offset;
+	uint16_t len;
+};
+
+static struct {
+	uint32_t num;
+	uintptr_t addr;
+	uint32_t pass;		// Stop the experiment after this many hits, 0 for never
+	uint32_t hits;
+	uint32_t used;		// Bytes of frames collected
+	bool enabled;
+	bool inserted;		// Breakpoint set for it, hw tells which kind
+	bool hw;
+	size_t action_count;
+	struct trace_action actions[GDBSTUB_TRACE_ACTIONS_MAX];
+} tracepoints[GDBSTUB_TRACEPOINTS_MAX];
+static size_t tracepoint_count = 0;
+
+/*
+ * The buffer holds trace_frames frames from trace_start up to trace_end.
+ * When it has wrapped, they continue at the beginning from trace_wrap on.
+ */
+static uint8_t trace_buf[GDBSTUB_TRACE_BUFLEN];
+static size_t trace_start = 0;
+static size_t trace_end = 0;
+static size_t trace_wrap = GDBSTUB_TRACE_BUFLEN;
+static bool trace_wrapped = false;
+static size_t trace_frames = 0;
+static uint32_t trace_created = 0;	// Frames collected since QTStart, dropped ones included
+static bool trace_circular = false;
+
+static bool trace_running = false;
+static enum {
+	trace_stop_unknown,		// Still running
+	trace_stop_notrun,
+	trace_stop_user,
+	trace_stop_full,
+	trace_stop_passcount
+} trace_stop_reason = trace_stop_notrun;
+static uint32_t trace_stop_tp;
+
+static int32_t trace_selected = -1;		// Selected frame number, -1 for the live target
+static size_t trace_selected_offset;
+
+// Cycles spent collecting the last frame, 'print gdbstub_trace_ccount' in GDB.
+uint32_t gdbstub_trace_ccount;
+
+static size_t frame_size(size_t offset) {
+	return trace_buf[offset] | (trace_buf[offset + 1] << 8);
+}
+
+static size_t frame_tp(size_t offset) {
+	return trace_buf[offset + 2] | (trace_buf[offset + 3] << 8);
+}
+
+static size_t frame_next(size_t offset) {
+	offset += frame_size(offset);
+	return trace_wrapped && offset == trace_wrap ? 0 : offset;
+}
+
+static void trace_clear() {
+	trace_start = 0;
+	trace_end = 0;
+	trace_wrap = GDBSTUB_TRACE_BUFLEN;
+	trace_wrapped = false;
+	trace_frames = 0;
+	trace_created = 0;
+	trace_selected = -1;
+}
+
+/*
+ * Make room for a frame of 'size' bytes. In a circular buffer the oldest
+ * frames are dropped for it, otherwise NULL is returned once it is full.
+ */
+static uint8_t * trace_alloc(size_t size) {
+	for (;;) {
+		if (trace_frames == 0) {
+			trace_start = 0;
+			trace_end = 0;
+			trace_wrap = GDBSTUB_TRACE_BUFLEN;
+			trace_wrapped = false;
+		}
+
+		if (!trace_wrapped && GDBSTUB_TRACE_BUFLEN - trace_end < size && trace_start >= size) {
+			trace_wrap = trace_end;
+			trace_end = 0;
+			trace_wrapped = true;
+		}
+
+		if ((trace_wrapped ? trace_start : GDBSTUB_TRACE_BUFLEN) - trace_end >= size) {
+			uint8_t * p = &trace_buf[trace_end];
+
+			trace_end += size;
+			return p;
+		}
+
+		if (!trace_circular) {
+			return NULL;
+		}
+
+		trace_start = frame_next(trace_start);
+		trace_frames--;
+
+		if (trace_start == 0 && trace_wrapped) {
+			trace_wrapped = false;
+			trace_wrap = GDBSTUB_TRACE_BUFLEN;
+		}
+	}
+}
+
+static bool trace_mem_addr(const struct trace_action * action, uintptr_t * addr) {
+	*addr = action->offset;
+
+	if (action->basereg >= 0) {
+		*addr += gdbstub_reg_get(action->basereg);
+	}
+
+	return gdbstub_mem_valid(*addr, action->len, GDBSTUB_MEM_R);
+}
+
+static void trace_insert(size_t i) {
+	uintptr_t addr = tracepoints[i].addr;
+	uint8_t op0;
+
+	// Narrow instructions have op0 8 to 13, they get a break.n
+	if (!gdbstub_mem_read(addr, &op0, 1)) {
+		return;
+	}
+
+	op0 &= 0xf;
+
+	if (gdbstub_sw_breakpoint_set(addr, op0 >= 8 && op0 <= 13 ? 2 : 3, BP_OWNER_TRACE)) {
+		tracepoints[i].inserted = true;
+		tracepoints[i].hw = false;
+	} else if (gdbstub_hw_breakpoint_set(addr, BP_OWNER_TRACE)) {
+		// Code in flash
+		tracepoints[i].inserted = true;
+		tracepoints[i].hw = true;
+	}
+}
+
+static void trace_stop(int reason, uint32_t tp) {
+	if (!trace_running) {
+		return;
+	}
+
+	for (size_t i = 0; i < tracepoint_count; i++) {
+		if (!tracepoints[i].inserted) {
+			continue;
+		}
+
+		if (tracepoints[i].hw) {
+			gdbstub_hw_breakpoint_del(tracepoints[i].addr, BP_OWNER_TRACE);
+		} else {
+			gdbstub_sw_breakpoint_del(tracepoints[i].addr, BP_OWNER_TRACE);
+		}
+
+		tracepoints[i].inserted = false;
+	}
+
+	trace_running = false;
+	trace_stop_reason = reason;
+	trace_stop_tp = tp;
+}
+
+static void trace_collect(size_t tp) {
+	struct trace_action * actions = tracepoints[tp].actions;
+	size_t size = TRACE_FRAME_HEADER;
+	uintptr_t addr;
+	uint32_t block_addr;
+
+	// Memory that can't be read is left out of the frame
+	for (size_t i = 0; i < tracepoints[tp].action_count; i++) {
+		if (actions[i].type == 'R') {
+			size += TRACE_REGS_HEADER + TRACE_REGS_SIZE;
+		} else if (trace_mem_addr(&actions[i], &addr)) {
+			size += TRACE_MEM_HEADER + actions[i].len;
+		}
+	}
+
+	uint8_t * p = trace_alloc(size);
+
+	if (p == NULL) {
+		trace_stop(trace_stop_full, 0);
+		return;
+	}
+
+	*p++ = size;
+	*p++ = size >> 8;
+	*p++ = tp;
+	*p++ = tp >> 8;
+
+	for (size_t i = 0; i < tracepoints[tp].action_count; i++) {
+		if (actions[i].type == 'R') {
+			*p++ = 'R';
+
+			for (size_t reg = 0; reg < GDB_REG_COUNT; reg++, p += 4) {
+				uint32_t val = gdbstub_reg_get(reg);
+
+				memcpy(p, &val, 4);
+			}
+		} else if (trace_mem_addr(&actions[i], &addr)) {
+			*p++ = 'M';
+			block_addr = addr;
+			memcpy(p, &block_addr, 4);
+			memcpy(p + 4, &actions[i].len, 2);
+			gdbstub_mem_read(addr, p + 6, actions[i].len);
+			p += 6 + actions[i].len;
+		}
+	}
+
+	trace_frames++;
+	trace_created++;
+	tracepoints[tp].hits++;
+	tracepoints[tp].used += size;
+
+	if (tracepoints[tp].pass != 0 && tracepoints[tp].hits >= tracepoints[tp].pass) {
+		trace_stop(trace_stop_passcount, tracepoints[tp].num);
+	}
+}
+
+/*
+ * Called on a breakpoint hit at pc. Collects a frame for every enabled
+ * tracepoint there and returns true if there was any.
+ */
+bool ATTR_GDBFN gdbstub_trace_hit(uintptr_t pc) {
+	uint32_t start = gdbstub_ccount();
+	bool hit = false;
+
+	for (size_t i = 0; trace_running && i < tracepoint_count; i++) {
+		if (tracepoints[i].enabled && tracepoints[i].addr == pc) {
+			trace_collect(i);
+			hit = true;
+		}
+	}
+
+	if (hit) {
+		gdbstub_trace_ccount = gdbstub_ccount() - start;
+	}
+
+	return hit;
+}
+
+static int find_tracepoint(uint32_t num, uintptr_t addr) {
+	for (size_t i = 0; i < tracepoint_count; i++) {
+		if (tracepoints[i].num == num && tracepoints[i].addr == addr) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// Largest frame a tracepoint can produce, it has to fit into the buffer.
+static size_t trace_frame_max(size_t tp) {
+	size_t size = TRACE_FRAME_HEADER;
+
+	for (size_t i = 0; i < tracepoints[tp].action_count; i++) {
+		if (tracepoints[tp].actions[i].type == 'R') {
+			size += TRACE_REGS_HEADER + TRACE_REGS_SIZE;
+		} else {
+			size += TRACE_MEM_HEADER + tracepoints[tp].actions[i].len;
+		}
+	}
+
+	return size;
+}
+
+/*
+ * QTDP:n:addr:E|D:step:pass defines a tracepoint, QTDP:-n:addr:action
+ * adds an action to it. Only R and M actions are supported, and no
+ * while-stepping ones.
+ */
+static bool trace_define(uint8_t * data) {
+	bool action = *data == '-';
+
+	if (action) {
+		data++;
+	}
+
+	uint32_t num = gdb_get_hex_val(&data, -1);
+	// skip ':'
+	data++;
+	uintptr_t addr = gdb_get_hex_val(&data, -1);
+	// skip ':'
+	data++;
+
+	if (!action) {
+		if (tracepoint_count == GDBSTUB_TRACEPOINTS_MAX || find_tracepoint(num, addr) >= 0) {
+			return false;
+		}
+
+		size_t tp = tracepoint_count;
+
+		tracepoints[tp].num = num;
+		tracepoints[tp].addr = addr;
+		tracepoints[tp].enabled = *data == 'E';
+		// skip 'E:', the step count is only used by while-stepping actions
+		data += 2;
+		gdb_get_hex_val(&data, -1);
+		data++;
+		tracepoints[tp].pass = gdb_get_hex_val(&data, -1);
+		tracepoints[tp].hits = 0;
+		tracepoints[tp].used = 0;
+		tracepoints[tp].inserted = false;
+		tracepoints[tp].action_count = 0;
+		tracepoint_count++;
+		return true;
+	}
+
+	int tp = find_tracepoint(num, addr);
+
+	if (tp < 0 || tracepoints[tp].action_count == GDBSTUB_TRACE_ACTIONS_MAX) {
+		return false;
+	}
+
+	struct trace_action * a = &tracepoints[tp].actions[tracepoints[tp].action_count];
+
+	a->type = *data++;
+
+	if (a->type == 'R') {
+		// All registers are collected, whatever the mask says
+		a->len = TRACE_REGS_SIZE;
+	} else if (a->type == 'M') {
+		if (*data == '-') {
+			// M-1: absolute address
+			data += 2;
+			a->basereg = -1;
+		} else {
+			a->basereg = gdb_get_hex_val(&data, -1);
+
+			if (a->basereg >= GDB_REG_COUNT) {
+				a->basereg = -1;
+			}
+		}
+
+		// skip ','
+		data++;
+		a->offset = gdb_get_hex_val(&data, -1);
+		data++;
+		long len = gdb_get_hex_val(&data, -1);
+
+		// Check before narrowing, the frame budget check below only sees
+		// what fits into a block header
+		if (len < 0 || len > 0xffff) {
+			return false;
+		}
+
+		a->len = len;
+	} else {
+		// X expressions and while-stepping (S) actions
+		return false;
+	}
+
+	tracepoints[tp].action_count++;
+
+	if (trace_frame_max(tp) > GDBSTUB_TRACE_BUFLEN) {
+		tracepoints[tp].action_count--;
+		return false;
+	}
+
+	return true;
+}
+
+// Find frame number n, returns its offset or -1.
+static int trace_find_frame(uint32_t n) {
+	uint32_t first = trace_created - trace_frames;
+	size_t offset = trace_start;
+
+	if (n < first || n >= trace_created) {
+		return -1;
+	}
+
+	while (n-- > first) {
+		offset = frame_next(offset);
+	}
+
+	return offset;
+}
+
+/*
+ * QTFrame:n, QTFrame:pc:addr, QTFrame:tdp:t, QTFrame:range:start:end and
+ * QTFrame:outside:start:end. The searches start after the selected frame.
+ */
+static void trace_select_frame(uint8_t * data) {
+	uint32_t n = trace_selected + 1;
+	uintptr_t lo = 0;
+	uintptr_t hi = 0;
+	char reply[24];
+	int mode;
+
+	if (strncmp((char *) data, "pc:", 3) == 0) {
+		data += 3;
+		lo = hi = gdb_get_hex_val(&data, -1);
+		mode = 'p';
+	} else if (strncmp((char *) data, "tdp:", 4) == 0) {
+		data += 4;
+		lo = gdb_get_hex_val(&data, -1);
+		mode = 't';
+	} else if (strncmp((char *) data, "range:", 6) == 0 || strncmp((char *) data, "outside:", 8) == 0) {
+		mode = *data;
+		data += mode == 'r' ? 6 : 8;
+		lo = gdb_get_hex_val(&data, -1);
+		data++;
+		hi = gdb_get_hex_val(&data, -1);
+	} else if (*data == '-') {
+		// Back to the live target
+		trace_selected = -1;
+		gdb_packet_str("OK");
+		return;
+	} else {
+		n = gdb_get_hex_val(&data, -1);
+		mode = 'n';
+	}
+
+	if (mode != 'n' && n < trace_created - trace_frames) {
+		// Older frames have been dropped
+		n = trace_created - trace_frames;
+	}
+
+	int offset = trace_find_frame(n);
+
+	while (offset >= 0 && mode != 'n') {
+		uintptr_t pc = tracepoints[frame_tp(offset)].addr;
+
+		if ((mode == 'p' && pc == lo)
+				|| (mode == 't' && tracepoints[frame_tp(offset)].num == lo)
+				|| (mode == 'r' && pc >= lo && pc <= hi)
+				|| (mode == 'o' && (pc < lo || pc > hi))) {
+			break;
+		}
+
+		n++;
+		offset = n < trace_created ? (int) frame_next(offset) : -1;
+	}
+
+	if (offset < 0) {
+		trace_selected = -1;
+		gdb_packet_str("F-1");
+		return;
+	}
+
+	trace_selected = n;
+	trace_selected_offset = offset;
+	snprintf(reply, sizeof(reply), "F%xT%x", (unsigned int) n, (unsigned int) tracepoints[frame_tp(offset)].num);
+	gdb_packet_str(reply);
+}
+
+static void trace_start_experiment() {
+	trace_stop(trace_stop_user, 0);
+	trace_clear();
+
+	for (size_t i = 0; i < tracepoint_count; i++) {
+		tracepoints[i].hits = 0;
+		tracepoints[i].used = 0;
+
+		if (tracepoints[i].enabled) {
+			trace_insert(i);
+		}
+	}
+
+	trace_running = true;
+	trace_stop_reason = trace_stop_unknown;
+}
+
+// Handle a QT packet, returns false if it isn't one we know.
+bool ATTR_GDBFN gdbstub_trace_command(uint8_t * cmd, size_t len) {
+	uint8_t * data = cmd + 3;
+	bool ok = true;
+
+	if (len < 3 || strncmp((char *) cmd, "QT", 2) != 0) {
+		return false;
+	}
+
+	gdb_packet_start();
+
+	if (strcmp((char *) cmd, "QTinit") == 0) {
+		trace_stop(trace_stop_user, 0);
+		trace_clear();
+		trace_stop_reason = trace_stop_notrun;
+		tracepoint_count = 0;
+	} else if (strncmp((char *) cmd, "QTDP:", 5) == 0) {
+		ok = trace_define(cmd + 5);
+	} else if (strcmp((char *) cmd, "QTStart") == 0) {
+		trace_start_experiment();
+	} else if (strcmp((char *) cmd, "QTStop") == 0) {
+		trace_stop(trace_stop_user, 0);
+	} else if (strncmp((char *) cmd, "QTFrame:", 8) == 0) {
+		trace_select_frame(cmd + 8);
+		gdb_packet_end();
+		return true;
+	} else if (strncmp((char *) cmd, "QTBuffer:circular:", 18) == 0) {
+		data = cmd + 18;
+		trace_circular = gdb_get_hex_val(&data, -1) != 0;
+	} else if (strncmp((char *) cmd, "QTro", 4) == 0) {
+		// Read-only regions are only a hint, nothing to do
+	} else {
+		// Trace state variables, disconnected tracing and the like are
+		// not supported
+		gdb_packet_end();
+		return true;
+	}
+
+	gdb_packet_str(ok ? "OK" : "E01");
+	gdb_packet_end();
+	return true;
+}
+
+// Handle the qTStatus and qTP queries, returns false for anything else.
+bool ATTR_GDBFN gdbstub_trace_query(uint8_t * query) {
+	char reply[160];
+
+	if (strcmp((char *) query, "TStatus") == 0) {
+		static const char * const reasons[] = { "tunknown:0", "tnotrun:0", "tstop::0", "tfull:0", "tpasscount:" };
+		size_t free_bytes = trace_wrapped ? trace_start - trace_end
+			: GDBSTUB_TRACE_BUFLEN - trace_end + trace_start;
+
+		if (trace_frames == 0) {
+			free_bytes = GDBSTUB_TRACE_BUFLEN;
+		}
+
+		snprintf(reply, sizeof(reply), "T%d;%s", trace_running, reasons[trace_stop_reason]);
+
+		if (trace_stop_reason == trace_stop_passcount) {
+			snprintf(reply + strlen(reply), sizeof(reply) - strlen(reply), "%x", (unsigned int) trace_stop_tp);
+		}
+
+		snprintf(reply + strlen(reply), sizeof(reply) - strlen(reply),
+			";tframes:%x;tcreated:%x;tfree:%x;tsize:%x;circular:%d;disconn:0",
+			(unsigned int) trace_frames, (unsigned int) trace_created, (unsigned int) free_bytes,
+			GDBSTUB_TRACE_BUFLEN, trace_circular);
+	} else if (strncmp((char *) query, "TP:", 3) == 0) {
+		// qTP:num:addr, hit count and bytes used
+		uint8_t * data = query + 3;
+		uint32_t num = gdb_get_hex_val(&data, -1);
+		data++;
+		int tp = find_tracepoint(num, gdb_get_hex_val(&data, -1));
+
+		if (tp < 0) {
+			return false;
+		}
+
+		snprintf(reply, sizeof(reply), "V%x:%x",
+			(unsigned int) tracepoints[tp].hits, (unsigned int) tracepoints[tp].used);
+	} else {
+		return false;
+	}
+
+	gdb_packet_start();
+	gdb_packet_str(reply);
+	gdb_packet_end();
+	return true;
+}
+
+bool ATTR_GDBFN gdbstub_trace_frame_selected() {
+	return trace_selected >= 0;
+}
+
+// Find a block of the selected frame. Returns a pointer to its header.
+static const uint8_t * trace_block(char type, uintptr_t addr, size_t len) {
+	const uint8_t * p = &trace_buf[trace_selected_offset];
+	const uint8_t * end = p + frame_size(trace_selected_offset);
+
+	for (p += TRACE_FRAME_HEADER; p < end; ) {
+		if (*p == 'R') {
+			if (type == 'R') {
+				return p;
+			}
+
+			p += TRACE_REGS_HEADER + TRACE_REGS_SIZE;
+		} else {
+			uint32_t block_addr;
+			uint16_t block_len;
+
+			memcpy(&block_addr, p + 1, 4);
+			memcpy(&block_len, p + 5, 2);
+
+			if (type == 'M' && addr >= block_addr && addr + len <= block_addr + block_len) {
+				return p;
+			}
+
+			p += TRACE_MEM_HEADER + block_len;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Registers of the selected frame. Without an R action only the pc is
+ * known, the others are reported as unavailable.
+ */
+bool ATTR_GDBFN gdbstub_trace_reg_read(size_t regnum, uint32_t * val) {
+	const uint8_t * regs = trace_block('R', 0, 0);
+
+	if (regs != NULL) {
+		memcpy(val, regs + TRACE_REGS_HEADER + regnum * 4, 4);
+		return true;
+	}
+
+	if (regnum == GDB_REG_PC) {
+		*val = tracepoints[frame_tp(trace_selected_offset)].addr;
+		return true;
+	}
+
+	return false;
+}
+
+void ATTR_GDBFN gdbstub_trace_regs_read() {
+	gdb_packet_start();
+
+	for (size_t i = 0; i < GDB_REG_COUNT; i++) {
+		uint32_t val;
+
+		if (gdbstub_trace_reg_read(i, &val)) {
+			gdb_packet_hex(bswap32(val), 32);
+		} else {
+			gdb_packet_str("xxxxxxxx");
+		}
+	}
+
+	gdb_packet_end();
+}
+
+// Collected memory of the selected frame, NULL if the range wasn't.
+const uint8_t * ATTR_GDBFN gdbstub_trace_mem(uintptr_t addr, size_t len) {
+	const uint8_t * block = trace_block('M', addr, len);
+	uint32_t block_addr;
+
+	if (block == NULL) {
+		return NULL;
+	}
+
+	memcpy(&block_addr, block + 1, 4);
+	return block + TRACE_MEM_HEADER + (addr - block_addr);
+}
@@ -0,0 +1,23 @@
+/*
+ * gdbstub-trace.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef GDBSTUB_TRACE_H_
+#define GDBSTUB_TRACE_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+bool gdbstub_trace_command(uint8_t * cmd, size_t len);
+bool gdbstub_trace_query(uint8_t * query);
+bool gdbstub_trace_hit(uintptr_t pc);
+
+bool gdbstub_trace_frame_selected();
+void gdbstub_trace_regs_read();
+bool gdbstub_trace_reg_read(size_t regnum, uint32_t * val);
+const uint8_t * gdbstub_trace_mem(uintptr_t addr, size_t len);
+
+#endif /* GDBSTUB_TRACE_H_ */
@@ -16,7 +16,11 @@
 #include "gdbstub.h"
 #include "gdbstub-entry.h"
 #include "gdbstub-cfg.h"
+#include "gdbstub-breakpoints.h"
 #include "gdbstub-freertos.h"
+#include "gdbstub-trace.h"
+#include "gdbstub-profile.h"
+#include "gdbstub-monitor.h"
 #include "gdbstub-internal.h"
 
 #include <sys/reent.h>
@@ -57,24 +61,35 @@ typedef void wdtfntype();
 typedef enum {
 	gdb_cmd_read_regs = 'g',
 	gdb_cmd_write_regs = 'G',
+	gdb_cmd_read_reg = 'p',
+	gdb_cmd_write_reg = 'P',
 	gdb_cmd_stop_reason = '?',
 	gdb_cmd_memory_read = 'm',
+	gdb_cmd_memory_read_bin = 'x',
 	gdb_cmd_memory_write = 'M',
+	gdb_cmd_memory_write_bin = 'X',
 	gdb_cmd_query_ex = 'q',
+	gdb_cmd_set_ex = 'Q',
 	gdb_cmd_long_name = 'v',
 	gdb_cmd_hw_breakpoint_set = 'Z',
 	gdb_cmd_hw_breakpoint_clear = 'z',
 	gdb_cmd_continue = 'c',
 	gdb_cmd_single_step = 's',
-	gdb_cmd_set_thread = 'H'
+	gdb_cmd_set_thread = 'H',
+	gdb_cmd_thread_alive = 'T',
+	gdb_cmd_detach = 'D',
+	gdb_cmd_kill = 'k'
 } gdb_serial_cmd_t;
 
 static wdtfntype *ets_wdt_disable = (wdtfntype *) 0x400030f0;
 static wdtfntype *ets_wdt_enable = (wdtfntype *) 0x40002fa0;
 
-// Length of buffer used to reserve GDB commands. Has to be at least able to fit the G command, which
+// The command buffer has to be at least able to fit the G command, which
 // implies a minimum size of about 190 bytes.
-#define PBUFLEN 256
+#if GDBSTUB_PBUFLEN < 192
+#error "GDBSTUB_PBUFLEN is too small to hold a G packet"
+#endif
+
 #define ETS_UART_INUM 5
 
 // Error states used by the routines that grab stuff from the incoming gdb packet
@@ -82,6 +97,7 @@ static wdtfntype *ets_wdt_enable = (wdtfntype *) 0x40002fa0;
 #define ST_ERR			-2
 #define ST_OK			-3
 #define ST_CONT			-4
+#define ST_UNKNOWN		-5
 
 // The asm stub saves the Xtensa registers here when a debugging exception happens.
 struct xtensa_exception_frame_t gdbstub_savedRegs;
@@ -89,10 +105,91 @@ struct xtensa_exception_frame_t gdbstub_savedRegs;
 // This is the debugging exception stack.
 uintptr_t gdbstub_exception_stack[256];
 
-static unsigned char cmd[PBUFLEN];		// GDB command input buffer
+static unsigned char cmd[GDBSTUB_PBUFLEN];		// GDB command input buffer
 static char gdbstub_packet_crc;			// Checksum of the output packet
+static bool gdb_noack = false;			// Set once GDB has agreed to QStartNoAckMode
+static bool gdb_attached = false;		// GDB is talking to us, console output goes into O packets
+static char gdb_run_char;				// Char repeated in the current output run
+static size_t gdb_run_count = 0;		// Length of the current output run
+
+static char gdb_tx_buf[GDBSTUB_TX_BUFLEN];	// Transmit ring buffer
+static volatile size_t gdb_tx_head = 0;		// Next free slot, written by packet layer
+static volatile size_t gdb_tx_tail = 0;		// Next byte to go to the UART FIFO
+
+/*
+ * Received bytes, filled by the UART interrupt while the target runs.
+ * Packets from GDB go to gdb_rx_buf, where gdb_recv_char() picks them up
+ * before it polls the FIFO; everything else goes to stdin_buf for the
+ * application.
+ */
+static uint8_t gdb_rx_buf[GDBSTUB_RX_BUFLEN];
+static volatile size_t gdb_rx_head = 0;		// Next free slot, written by the interrupt
+static volatile size_t gdb_rx_tail = 0;		// Next byte for gdb_recv_char()
+static uint8_t stdin_buf[GDBSTUB_STDIN_BUFLEN];
+static volatile size_t stdin_head = 0;
+static volatile size_t stdin_tail = 0;
+
+// Where the UART interrupt is in the byte stream from GDB
+static enum {
+	RX_CONSOLE,		// Outside of a packet
+	RX_PACKET,		// Between '$' and '#'
+	RX_CHECKSUM1,	// Checksum digits
+	RX_CHECKSUM2,
+} rx_state = RX_CONSOLE;
+static uint8_t rx_sum;				// Checksum of the packet being received
+static uint8_t rx_checksum;			// Checksum sent with it
+static size_t rx_packet_start;		// Where it starts in gdb_rx_buf
+
+// Console output waiting to be put into O packets
+static char console_buf[GDBSTUB_CONSOLE_BUFLEN];
+static volatile size_t console_head = 0;
+static volatile size_t console_tail = 0;
+
+// Bytes of console output lost because the buffer was full. Can be
+// inspected from GDB with 'print gdbstub_console_dropped'.
+uint32_t gdbstub_console_dropped = 0;
+
+// Cycles between watchdog feeds while waiting for GDB, 1 ms at 80 MHz
+#define WDT_FEED_CYCLES 80000
+
+// Baud rate to go back to unless GDB confirms a "monitor baud" change by
+// sending a valid packet at the new rate in time, 0 when none is pending.
+static int baud_fallback = 0;
+static uint32_t baud_fallback_ccount;
+
+// Time GDB has to confirm a new baud rate, 2 s at 80 MHz
+#define BAUD_CONFIRM_CYCLES 160000000
+
+// Cycles spent handling the last command, including the time it took to
+// queue its reply. Can be inspected from GDB with 'print gdbstub_cmd_ccount'.
+uint32_t gdbstub_cmd_ccount;
+
+// Link and session counters, shown by "monitor stats"
+static struct {
+	uint32_t packets_in;
+	uint32_t bytes_in;
+	uint32_t checksum_errors;	// Packets from GDB rejected with '-'
+	uint32_t packets_out;
+	uint32_t bytes_out;
+	uint32_t naks;				// Packets of ours GDB rejected with '-'
+	uint32_t stops;
+	uint64_t stopped_cycles;
+	uint32_t stopped_ccount;	// Last time stopped_cycles was brought up to date
+} gdb_stats;
+
+struct gdbstub_handler_stats {
+	uint32_t calls;
+	uint64_t cycles;
+};
+
+// Cost of the commands by packet letter, the last entry counts the others
+static const char gdb_stats_letters[] = "?cDgGHkmMpPqQsTvxXzZ";
+static struct gdbstub_handler_stats gdb_cmd_stats[sizeof(gdb_stats_letters)];
 
 static int32_t single_step_ps = -1;			// Stores ps when single-stepping instruction. -1 when not in use.
+static uintptr_t range_step_start = 0;		// Range GDB asked to step through with vCont;r,
+static uintptr_t range_step_end = 0;		// end is 0 when not range stepping.
+static bool bp_step_over = false;			// Single-stepping over a lifted breakpoint to continue
 
 static void gdbstub_icount_ena_single_step() {
 	__asm volatile (
@@ -124,37 +221,158 @@ static void ATTR_GDBFN wdt_keep_alive() {
 	*wdtctl |= (1 << 31);
 }
 
-// Receive a char from the uart. Uses polling and feeds the watchdog.
+// Move as much of the transmit buffer to the UART FIFO as it has room for.
+// Waits until at least 'min' bytes of FIFO space are available.
+static void ATTR_GDBFN gdb_tx_fill(int min) {
+	int space = uart_txfifo_wait(0, min);
+	size_t tail = gdb_tx_tail;
+
+	while (space > 0 && tail != gdb_tx_head) {
+		UART(0).FIFO = gdb_tx_buf[tail];
+		tail = (tail + 1) & (GDBSTUB_TX_BUFLEN - 1);
+		space--;
+	}
+
+	gdb_tx_tail = tail;
+}
+
+// Push everything queued in the transmit buffer into the UART FIFO.
+static void ATTR_GDBFN gdb_tx_flush() {
+	while (gdb_tx_tail != gdb_tx_head) {
+		gdb_tx_fill(1);
+	}
+}
+
+// Start draining the transmit buffer while the target keeps running.
+static void ATTR_GDBFN gdb_tx_kick() {
+#if GDBSTUB_TX_INTERRUPT
+	gdb_tx_fill(0);
+
+	if (gdb_tx_tail != gdb_tx_head) {
+		UART(0).INT_ENABLE |= UART_INT_ENABLE_TXFIFO_EMPTY;
+	}
+#else
+	gdb_tx_flush();
+#endif
+}
+
+// Add the time since the last call to the time spent stopped. Called often
+// enough while stopped for the 32-bit ccount not to wrap in between.
+static void ATTR_GDBFN gdb_stats_stopped_update() {
+	uint32_t now = gdbstub_ccount();
+
+	gdb_stats.stopped_cycles += now - gdb_stats.stopped_ccount;
+	gdb_stats.stopped_ccount = now;
+}
+
+// Receive a char from GDB. Bytes that arrived while the target was running
+// come first, then the uart is polled. Feeds the watchdog and moves pending
+// output to the FIFO while waiting.
 static int ATTR_GDBFN gdb_recv_char() {
+	uint32_t fed = gdbstub_ccount();
 	int i;
+
+	gdb_stats.bytes_in++;
+
+	if (gdb_rx_tail != gdb_rx_head) {
+		i = gdb_rx_buf[gdb_rx_tail];
+		gdb_rx_tail = (gdb_rx_tail + 1) & (GDBSTUB_RX_BUFLEN - 1);
+		return i;
+	}
+
 	while (FIELD2VAL(UART_STATUS_RXFIFO_COUNT, UART(0).STATUS) == 0) {
-		wdt_keep_alive();
+		if (gdb_tx_tail != gdb_tx_head) {
+			gdb_tx_fill(0);
+		}
+
+		if (gdbstub_ccount() - fed > WDT_FEED_CYCLES) {
+			wdt_keep_alive();
+			gdb_stats_stopped_update();
+			fed = gdbstub_ccount();
+		}
+
+		if (baud_fallback != 0 && gdbstub_ccount() - baud_fallback_ccount > BAUD_CONFIRM_CYCLES) {
+			uart_set_baud(0, baud_fallback);
+			baud_fallback = 0;
+		}
 	}
-	i = UART(0).FIFO;
+
+	i = UART(0).FIFO & 0xff;
 	return i;
 }
 
-// Send a char to the uart.
+// Queue a char for the uart. Only touches the FIFO when the buffer is full.
+static void ATTR_GDBFN gdb_tx_put(char c) {
+	size_t next = (gdb_tx_head + 1) & (GDBSTUB_TX_BUFLEN - 1);
+
+	while (next == gdb_tx_tail) {
+		// Wait for a reasonable amount of space rather than a single byte
+		// so we don't spin on the status register.
+		gdb_tx_fill(UART_FIFO_MAX / 4);
+	}
+
+	gdb_tx_buf[gdb_tx_head] = c;
+	gdb_tx_head = next;
+}
+
+// Queue a char for GDB.
 static void ATTR_GDBFN gdb_send_char(char c) {
-	uart_txfifo_wait(0, 1);
-	UART(0).FIFO = c;
+	gdb_stats.bytes_out++;
+	gdb_tx_put(c);
+}
+
+// Send a char as part of a packet and add it to the checksum.
+static void ATTR_GDBFN gdb_packet_raw(char c) {
+	gdb_send_char(c);
+	gdbstub_packet_crc += c;
+}
+
+// Send the buffered run of identical chars. Runs of four or more are
+// encoded as the char followed by '*' and a repeat count of n + 29.
+static void ATTR_GDBFN gdb_packet_run_flush() {
+	size_t n = gdb_run_count;
+
+	gdb_run_count = 0;
+
+	while (n > 0) {
+		gdb_packet_raw(gdb_run_char);
+		n--;
+
+		// Keep the count char printable ('~' at most), and skip '#' and '$'
+		size_t repeat = n > 97 ? 97 : n;
+
+		if (repeat == 6 || repeat == 7) {
+			repeat = 5;
+		}
+
+		if (repeat >= 3) {
+			gdb_packet_raw('*');
+			gdb_packet_raw(repeat + 29);
+			n -= repeat;
+		}
+	}
 }
 
 // Send the start of a packet; reset checksum calculation.
 void gdb_packet_start() {
 	gdbstub_packet_crc = 0;
+	gdb_run_count = 0;
+	gdb_stats.packets_out++;
 	gdb_send_char('$');
 }
 
 // Send a char as part of a packet
 void gdb_packet_char(char c) {
 	if (c=='#' || c=='$' || c=='}' || c=='*') {
-		gdb_send_char('}');
-		gdb_send_char(c ^ 0x20);
-		gdbstub_packet_crc += (c ^ 0x20) + '}';
+		gdb_packet_run_flush();
+		gdb_packet_raw('}');
+		gdb_packet_raw(c ^ 0x20);
+	} else if (gdb_run_count > 0 && c == gdb_run_char) {
+		gdb_run_count++;
 	} else {
-		gdb_send_char(c);
-		gdbstub_packet_crc += c;
+		gdb_packet_run_flush();
+		gdb_run_char = c;
+		gdb_run_count = 1;
 	}
 }
 
@@ -177,15 +395,151 @@ void gdb_packet_hex(int val, int bits) {
 
 // Finish sending a packet.
 void gdb_packet_end() {
+	char hexChars[] = "0123456789abcdef";
+
+	gdb_packet_run_flush();
 	gdb_send_char('#');
-	gdb_packet_hex(gdbstub_packet_crc, 8);
+	gdb_send_char(hexChars[(gdbstub_packet_crc >> 4) & 0xf]);
+	gdb_send_char(hexChars[gdbstub_packet_crc & 0xf]);
+}
+
+// Start an 'O' packet: output for the GDB console. Send the text with
+// gdb_console_char() and finish it with gdb_packet_end().
+void gdb_console_start() {
+	gdb_packet_start();
+	gdb_packet_char('O');
+}
+
+void gdb_console_char(char c) {
+	gdb_packet_hex(c, 8);
+}
+
+// Send a string to the GDB console as a packet of its own.
+void gdb_console_str(const char * c) {
+	gdb_console_start();
+
+	while (*c != 0) {
+		gdb_console_char(*c++);
+	}
+
+	gdb_packet_end();
+}
+
+// Move pending console output into O packets in the transmit buffer, as
+// far as it has room for them. Each byte takes two hex digits, a packet
+// five more. Without GDB attached the bytes are passed through as they are.
+static void ATTR_GDBFN gdb_console_fill() {
+	while (console_tail != console_head) {
+		size_t space = (gdb_tx_tail - gdb_tx_head - 1) & (GDBSTUB_TX_BUFLEN - 1);
+		size_t pending = (console_head - console_tail) & (GDBSTUB_CONSOLE_BUFLEN - 1);
+		size_t tail = console_tail;
+
+		if (!gdb_attached) {
+			if (space == 0) {
+				return;
+			}
+
+			while (pending-- > 0 && space-- > 0) {
+				// Not for GDB, so not in the stats either
+				gdb_tx_put(console_buf[tail]);
+				tail = (tail + 1) & (GDBSTUB_CONSOLE_BUFLEN - 1);
+			}
+
+			console_tail = tail;
+			continue;
+		}
+
+		if (space < 5 + 2) {
+			return;
+		}
+
+		if (pending > (space - 5) / 2) {
+			pending = (space - 5) / 2;
+		}
+
+		gdb_console_start();
+
+		while (pending-- > 0) {
+			gdb_console_char(console_buf[tail]);
+			tail = (tail + 1) & (GDBSTUB_CONSOLE_BUFLEN - 1);
+		}
+
+		gdb_packet_end();
+		console_tail = tail;
+	}
+}
+
+// Send all pending console output, waiting for the UART as needed.
+void ATTR_GDBFN gdb_console_flush() {
+	while (console_tail != console_head) {
+		gdb_console_fill();
+		gdb_tx_fill(UART_FIFO_MAX / 4);
+	}
+}
+
+// State of the qXfer object being sent, see gdb_xfer_reply()
+static struct {
+	size_t offset;
+	size_t end;
+	size_t pos;
+	bool emit;
+} xfer_state;
+
+// Append a string to a qXfer object. Only the part falling into the
+// requested window ends up in the packet.
+void gdb_xfer_str(const char * c) {
+	while (*c != 0) {
+		if (xfer_state.emit && xfer_state.pos >= xfer_state.offset && xfer_state.pos < xfer_state.end) {
+			gdb_packet_char(*c);
+		}
+
+		xfer_state.pos++;
+		c++;
+	}
+}
+
+// Append binary data to a qXfer object.
+void gdb_xfer_data(const void * data, size_t len) {
+	const uint8_t * p = data;
+
+	if (xfer_state.emit) {
+		size_t start = xfer_state.offset > xfer_state.pos ? xfer_state.offset - xfer_state.pos : 0;
+		size_t end = xfer_state.end > xfer_state.pos ? xfer_state.end - xfer_state.pos : 0;
+
+		for (size_t i = start; i < end && i < len; i++) {
+			gdb_packet_char(p[i]);
+		}
+	}
+
+	xfer_state.pos += len;
+}
+
+// Reply to a qXfer read request with the window [offset, offset + length) of
+// the object generated by 'fn'. The generator runs twice: the first pass only
+// measures the object, so the reply can start with 'l' when the window
+// reaches its end and with 'm' otherwise.
+void gdb_xfer_reply(void (* fn)(), size_t offset, size_t length) {
+	xfer_state.offset = offset;
+	xfer_state.end = offset + length;
+	xfer_state.pos = 0;
+	xfer_state.emit = false;
+	fn();
+
+	gdb_packet_start();
+	gdb_packet_char(xfer_state.end < xfer_state.pos ? 'm' : 'l');
+
+	xfer_state.pos = 0;
+	xfer_state.emit = true;
+	fn();
+
+	gdb_packet_end();
 }
 
 // Grab a hex value from the gdb packet. Ptr will get positioned on the end
 // of the hex string, as far as the routine has read into it. Bits/4 indicates
 // the max amount of hex chars it gobbles up. Bits can be -1 to eat up as much
 // hex chars as possible.
-static long ATTR_GDBFN gdb_get_hex_val(uint8_t **ptr, size_t bits) {
+long ATTR_GDBFN gdb_get_hex_val(uint8_t **ptr, size_t bits) {
 	size_t i;
 	uint32_t no;
 	uint32_t v = 0;
@@ -223,58 +577,187 @@ static long ATTR_GDBFN gdb_get_hex_val(uint8_t **ptr, size_t bits) {
 	return v;
 }
 
-// Read a byte from the ESP8266 memory.
-static uint8_t ATTR_GDBFN mem_read_byte(uintptr_t p) {
-	int * i = (int *) (p & (~3));
+/*
+ * ESP8266 memory map. Everything not listed here is reported as inaccessible
+ * to GDB through qXfer:memory-map:read, and accesses to it are refused.
+ * IRAM, ROM, flash and the register blocks only decode 32-bit accesses, which
+ * is why all reads are done a word at a time and partial writes go through
+ * read-modify-write.
+ */
+static const struct gdbstub_mem_region gdbstub_mem_regions[] = {
+	{ 0x3ff00000, 0x000e8000, GDBSTUB_MEM_R | GDBSTUB_MEM_W | GDBSTUB_MEM_WORD },	// DPORT, WDEV registers
+	{ 0x3ffe8000, 0x00018000, GDBSTUB_MEM_R | GDBSTUB_MEM_W },						// DRAM
+	{ 0x40000000, 0x00010000, GDBSTUB_MEM_R | GDBSTUB_MEM_WORD },					// Boot ROM
+	{ 0x40100000, 0x00010000, GDBSTUB_MEM_R | GDBSTUB_MEM_W | GDBSTUB_MEM_WORD },	// IRAM
+	{ 0x40200000, 0x00100000, GDBSTUB_MEM_R | GDBSTUB_MEM_WORD },					// SPI flash, cached
+	{ 0x60000000, 0x00002000, GDBSTUB_MEM_R | GDBSTUB_MEM_W | GDBSTUB_MEM_WORD },	// Peripheral registers
+};
 
-	// TODO: better address range check?
-	if (p < 0x20000000 || p >= 0x60000000) {
-		return -1;
+#define MEM_REGION_COUNT (sizeof(gdbstub_mem_regions) / sizeof(gdbstub_mem_regions[0]))
+
+// Check that every byte of [p, p + len) lies in a region allowing 'access'.
+// The range may span several adjacent regions.
+bool ATTR_GDBFN gdbstub_mem_valid(uintptr_t p, size_t len, uint8_t access) {
+	while (len > 0) {
+		const struct gdbstub_mem_region * region = NULL;
+
+		for (size_t i = 0; i < MEM_REGION_COUNT; i++) {
+			if (p >= gdbstub_mem_regions[i].base
+					&& p - gdbstub_mem_regions[i].base < gdbstub_mem_regions[i].size) {
+				region = &gdbstub_mem_regions[i];
+				break;
+			}
+		}
+
+		if (region == NULL || (region->flags & access) != access) {
+			return false;
+		}
+
+		size_t left = region->base + region->size - p;
+
+		if (len <= left) {
+			break;
+		}
+
+		p += left;
+		len -= left;
 	}
 
-	return * i >> ((p & 3) * 8);
+	return true;
 }
 
-// Write a byte to the ESP8266 memory.
+// Copy target memory to buf. Each word is loaded only once.
+bool ATTR_GDBFN gdbstub_mem_read(uintptr_t p, void * buf, size_t len) {
+	uint8_t * out = buf;
+	uintptr_t end = p + len;
+
+	if (!gdbstub_mem_valid(p, len, GDBSTUB_MEM_R)) {
+		return false;
+	}
+
+	while (p < end) {
+		uint32_t word = *(volatile uint32_t *) (p & ~3);
+
+		for (size_t shift = (p & 3) * 8; shift < 32 && p < end; shift += 8, p++) {
+			*out++ = word >> shift;
+		}
+	}
+
+	return true;
+}
+
+// Write a byte to the ESP8266 memory. The caller checks the address.
 static void ATTR_GDBFN mem_write_byte(uintptr_t p, uint8_t d) {
-	int *i = (int*) (p & (~3));
+	volatile uint32_t * i = (volatile uint32_t *) (p & ~3);
+	size_t shift = (p & 3) * 8;
 
-	if (p < 0x20000000 || p >= 0x60000000) {
-		return;
+	*i = (*i & ~(0xffu << shift)) | ((uint32_t) d << shift);
+}
+
+// Write a buffer to the ESP8266 memory. The aligned middle part is stored a
+// word at a time, only the unaligned head and tail go through mem_write_byte.
+bool ATTR_GDBFN gdbstub_mem_write(uintptr_t p, const void * data, size_t len) {
+	const uint8_t * buf = data;
+
+	if (!gdbstub_mem_valid(p, len, GDBSTUB_MEM_W)) {
+		return false;
+	}
+
+	while (len > 0 && (p & 3) != 0) {
+		mem_write_byte(p++, *buf++);
+		len--;
 	}
 
-	if ((p & 3) == 0) {
-		*i = (*i & 0xffffff00) | (d << 0);
+	while (len >= 4) {
+		*(volatile uint32_t *) p = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+		p += 4;
+		buf += 4;
+		len -= 4;
 	}
 
-	if ((p & 3) == 1) {
-		*i = (*i & 0xffff00ff) | (d << 8);
+	while (len > 0) {
+		mem_write_byte(p++, *buf++);
+		len--;
 	}
 
-	if ((p & 3) == 2) {
-		*i = (*i & 0xff00ffff) | (d << 16);
+	// Make sure caches are up-to-date. Procedure according to Xtensa ISA document, ISYNC inst desc.
+	__asm volatile (
+		"isync \n"
+		"isync \n"
+	);
+
+	return true;
+}
+
+// Read a byte from the ESP8266 memory, 0xff if it is not accessible.
+static uint8_t ATTR_GDBFN mem_read_byte(uintptr_t p) {
+	uint8_t d;
+
+	if (!gdbstub_mem_read(p, &d, 1)) {
+		return -1;
 	}
 
-	if ((p & 3) == 3) {
-		*i = (*i & 0x00ffffff) | (d << 24);
+	return d;
+}
+
+// Send target memory as part of a packet, as hex or as escaped binary.
+// Each word is loaded only once.
+static void ATTR_GDBFN mem_send(uintptr_t p, size_t len, bool binary) {
+	uintptr_t end = p + len;
+
+	while (p < end) {
+		uint32_t word = *(volatile uint32_t *) (p & ~3);
+
+		for (size_t shift = (p & 3) * 8; shift < 32 && p < end; shift += 8, p++) {
+			if (binary) {
+				gdb_packet_char(word >> shift);
+			} else {
+				gdb_packet_hex((word >> shift) & 0xff, 8);
+			}
+		}
 	}
 }
 
-// Returns 1 if it makes sense to write to addr p
-static uint8_t ATTR_GDBFN mem_addr_valid(uintptr_t p) {
-	if (p >= 0x3ff00000 && p < 0x40000000) {
-		return 1;
+// Send memory collected in the selected trace frame, or an error if the
+// range wasn't collected.
+static void ATTR_GDBFN gdb_trace_mem_send(uintptr_t p, size_t len, bool binary) {
+	const uint8_t * data = gdbstub_trace_mem(p, len);
+
+	if (data == NULL) {
+		gdb_packet_str("E01");
+		return;
 	}
 
-	if (p >= 0x40100000 && p < 0x40140000) {
-		return 1;
+	if (binary) {
+		gdb_packet_char('b');
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		if (binary) {
+			gdb_packet_char(data[i]);
+		} else {
+			gdb_packet_hex(data[i], 8);
+		}
 	}
+}
+
+// Memory map document for qXfer:memory-map:read
+static void ATTR_GDBFN gdbstub_mem_map() {
+	char entry[64];
 
-	if (p >= 0x60000000 && p < 0x60002000) {
-		return 1;
+	gdb_xfer_str("<?xml version=\"1.0\"?>");
+	gdb_xfer_str("<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" "
+		"\"http://sourceware.org/gdb/gdb-memory-map.dtd\">");
+	gdb_xfer_str("<memory-map>");
+
+	for (size_t i = 0; i < MEM_REGION_COUNT; i++) {
+		snprintf(entry, sizeof(entry), "<memory type=\"%s\" start=\"0x%x\" length=\"0x%x\"/>",
+			(gdbstub_mem_regions[i].flags & GDBSTUB_MEM_W) ? "ram" : "rom",
+			(unsigned int) gdbstub_mem_regions[i].base, (unsigned int) gdbstub_mem_regions[i].size);
+		gdb_xfer_str(entry);
 	}
 
-	return 0;
+	gdb_xfer_str("</memory-map>");
 }
 
 /* 
@@ -293,12 +776,24 @@ struct regfile {
 	uint32_t ps;
 };
 
+// Send a register as an expedited 'n:r;' pair of a stop reply.
+static void ATTR_GDBFN gdb_packet_reg(size_t regnum, uint32_t val) {
+	gdb_packet_hex(regnum, 8);
+	gdb_packet_char(':');
+	gdb_packet_hex(bswap32(val), 32);
+	gdb_packet_char(';');
+}
+
 // Send the reason execution is stopped to GDB.
 static void ATTR_GDBFN gdb_send_reason() {
 	// exception-to-signal mapping
 	uint8_t exceptionSignal[] = { 4, 31, 11, 11, 2, 6, 8, 0, 6, 7, 0, 0, 7, 7, 7, 7 };
 	size_t i = 0;
 
+	// Output from before the stop goes first, the console is GDB's from now on
+	gdb_console_flush();
+	gdb_attached = true;
+
 	gdb_packet_start();
 	gdb_packet_char('T');
 
@@ -313,78 +808,421 @@ static void ATTR_GDBFN gdb_send_reason() {
 			gdb_packet_hex(11, 8);
 		}
 	} else {
-		// We stopped because of a debugging exception.
+		// We stopped because of a debugging exception. Tell GDB why, so it
+		// doesn't have to work it out from registers and memory.
 		gdb_packet_hex(5, 8); // sigtrap
-		// Current Xtensa GDB versions don't seem to request this, so let's leave it off.
-#if 0
-		if (gdbstub_savedRegs.reason&(1<<0)) {
-			reason="break";
+
+		if (gdbstub_savedRegs.reason & ((1 << 3) | (1 << 4))) {
+			// BREAK or BREAK.N
+			gdb_packet_str("swbreak:;");
+		} else if (gdbstub_savedRegs.reason & (1 << 1)) {
+			gdb_packet_str("hwbreak:;");
+		} else if (gdbstub_savedRegs.reason & (1 << 2)) {
+			uint32_t dbreaka, dbreakc;
+
+			__asm volatile ("rsr %0, %1" : "=r" (dbreaka) : "i" (DBREAKA));
+			__asm volatile ("rsr %0, %1" : "=r" (dbreakc) : "i" (DBREAKC));
+
+			// Bit 30 breaks on loads, bit 31 on stores
+			if ((dbreakc & 0xc0000000) == 0xc0000000) {
+				gdb_packet_str("awatch:");
+			} else if (dbreakc & 0x40000000) {
+				gdb_packet_str("rwatch:");
+			} else {
+				gdb_packet_str("watch:");
+			}
+
+			gdb_packet_hex(dbreaka, 32);
+			gdb_packet_char(';');
 		}
-		if (gdbstub_savedRegs.reason&(1<<1)) {
-			reason="hwbreak";
+	}
+
+	// Expedite the registers GDB needs to find the frame right away
+	gdb_packet_reg(GDB_REG_PC, gdbstub_savedRegs.pc);
+	gdb_packet_reg(GDB_REG_A1, gdbstub_savedRegs.a1);
+	gdb_packet_reg(GDB_REG_A0, gdbstub_savedRegs.a0);
+
+#if GDBSTUB_THREAD_AWARE
+	gdbstub_freertos_report_thread();
+#endif
+
+	gdb_packet_end();
+}
+
+/*
+ * "monitor baud <rate>": the reply goes out at the old rate, then the UART
+ * switches. Unless a valid packet arrives at the new rate within
+ * BAUD_CONFIRM_CYCLES, the old rate is restored. Without a rate, prints the
+ * current one.
+ */
+bool ATTR_GDBFN gdbstub_monitor_baud(const char * arg) {
+	char line[48];
+	long rate = strtol(arg, NULL, 10);
+
+	if (rate == 0) {
+		snprintf(line, sizeof(line), "%d baud\n", uart_get_baud(0));
+		gdb_console_str(line);
+	} else if (rate < 300 || rate > 4000000) {
+		gdb_console_str("Invalid baud rate\n");
+	} else {
+		snprintf(line, sizeof(line), "Switching to %ld baud\n", rate);
+		gdb_console_str(line);
+	}
+
+	gdb_packet_start();
+	gdb_packet_str("OK");
+	gdb_packet_end();
+
+	if (rate < 300 || rate > 4000000) {
+		return true;
+	}
+
+	gdb_tx_flush();
+	uart_flush_txfifo(0);
+
+	// Give GDB 10 ms to ack the reply, drop whatever comes in
+	for (uint32_t start = gdbstub_ccount(); gdbstub_ccount() - start < 800000;) {
+		if (FIELD2VAL(UART_STATUS_RXFIFO_COUNT, UART(0).STATUS) != 0) {
+			(void) UART(0).FIFO;
 		}
-		if (gdbstub_savedRegs.reason&(1<<2)) {
-			reason="watch";
+	}
+
+	gdb_rx_tail = gdb_rx_head;
+	baud_fallback = uart_get_baud(0);
+	baud_fallback_ccount = gdbstub_ccount();
+	uart_set_baud(0, rate);
+	return true;
+}
+
+/*
+ * Handlers of the q, Q and v packets, looked up by the packet letter and
+ * the prefix that follows it. A handler gets the whole packet, its length
+ * and the arguments after the prefix. It returns ST_UNKNOWN to let the
+ * next matching handler try, or one of the gdb_handle_command results.
+ */
+struct gdb_ext_handler {
+	char type;
+	const char * prefix;
+	int (* fn)(uint8_t * cmd, size_t len, uint8_t * args);
+	struct gdbstub_handler_stats stats;
+};
+
+static int ATTR_GDBFN q_supported(uint8_t * cmd, size_t len, uint8_t * args) {
+	const char * features =
+		"swbreak+;"
+		"hwbreak+;"
+		"X+;"
+		"binary-upload+;"
+		"qXfer:memory-map:read+;"
+		"QStartNoAckMode+;"
+		"ConditionalBreakpoints+;"
+		"BreakpointCommands+;";
+
+	// A (re)connecting GDB starts out in ack mode
+	gdb_noack = false;
+
+	gdb_packet_start();
+	gdb_packet_str(features);
+#if GDBSTUB_THREAD_AWARE && GDBSTUB_THREADS_XML
+	gdb_packet_str("qXfer:threads:read+;");
+#endif
+#if GDBSTUB_PROFILE
+	gdb_packet_str("qXfer:profile:read+;");
+#endif
+	// One byte of the buffer is taken by the terminating zero
+	gdb_packet_str("PacketSize=");
+	gdb_packet_hex(GDBSTUB_PBUFLEN - 1, 32);
+	gdb_packet_end();
+	return ST_OK;
+}
+
+// Reply to a qXfer read, args being "offset,length"
+static int ATTR_GDBFN q_xfer(uint8_t * args, void (* fn)()) {
+	size_t offset = gdb_get_hex_val(&args, -1);
+	args++;
+	size_t length = gdb_get_hex_val(&args, -1);
+
+	gdb_xfer_reply(fn, offset, length);
+	return ST_OK;
+}
+
+static int ATTR_GDBFN q_xfer_memory_map(uint8_t * cmd, size_t len, uint8_t * args) {
+	return q_xfer(args, gdbstub_mem_map);
+}
+
+#if GDBSTUB_THREAD_AWARE && GDBSTUB_THREADS_XML
+static int ATTR_GDBFN q_xfer_threads(uint8_t * cmd, size_t len, uint8_t * args) {
+	return q_xfer(args, gdbstub_freertos_task_list);
+}
+#endif
+
+#if GDBSTUB_PROFILE
+static int ATTR_GDBFN q_xfer_profile(uint8_t * cmd, size_t len, uint8_t * args) {
+	return q_xfer(args, gdbstub_profile_xfer);
+}
+#endif
+
+static int ATTR_GDBFN q_rcmd(uint8_t * cmd, size_t len, uint8_t * args) {
+	gdbstub_monitor(args);
+	return ST_OK;
+}
+
+// Queries of the other modules, they check the packet themselves
+static int ATTR_GDBFN q_modules(uint8_t * cmd, size_t len, uint8_t * args) {
+#if GDBSTUB_THREAD_AWARE
+	if (gdbstub_freertos_query(args)) {
+		// Thread list, names and current thread
+		return ST_OK;
+	}
+#endif
+
+	if (gdbstub_trace_query(args)) {
+		// Trace experiment status
+		return ST_OK;
+	}
+
+	return ST_UNKNOWN;
+}
+
+static int ATTR_GDBFN set_start_noack(uint8_t * cmd, size_t len, uint8_t * args) {
+	// GDB stops acking once it has seen the OK, and so do we
+	gdb_packet_start();
+	gdb_packet_str("OK");
+	gdb_packet_end();
+	gdb_noack = true;
+	return ST_OK;
+}
+
+static int ATTR_GDBFN set_trace(uint8_t * cmd, size_t len, uint8_t * args) {
+	// Tracepoint definition and control
+	return gdbstub_trace_command(cmd, len) ? ST_OK : ST_UNKNOWN;
+}
+
+static int ATTR_GDBFN v_cont_query(uint8_t * cmd, size_t len, uint8_t * args) {
+	gdb_packet_start();
+	gdb_packet_str("vCont;c;s;r");
+	gdb_packet_end();
+	return ST_OK;
+}
+
+static int ATTR_GDBFN v_cont_continue(uint8_t * cmd, size_t len, uint8_t * args) {
+	// continue execution
+	return ST_CONT;
+}
+
+static int ATTR_GDBFN v_cont_range(uint8_t * cmd, size_t len, uint8_t * args) {
+	// step until pc leaves [start, end), see gdbstub_handle_debug_exception
+	range_step_start = gdb_get_hex_val(&args, -1);
+	// skip ','
+	args++;
+	range_step_end = gdb_get_hex_val(&args, -1);
+	gdbstub_single_step();
+	return ST_CONT;
+}
+
+static int ATTR_GDBFN v_cont_step(uint8_t * cmd, size_t len, uint8_t * args) {
+	gdbstub_single_step();
+	return ST_CONT;
+}
+
+static struct gdb_ext_handler gdb_ext_handlers[] = {
+	{ 'q', "Supported", q_supported },
+	{ 'q', "Xfer:memory-map:read::", q_xfer_memory_map },
+#if GDBSTUB_THREAD_AWARE && GDBSTUB_THREADS_XML
+	{ 'q', "Xfer:threads:read::", q_xfer_threads },
+#endif
+#if GDBSTUB_PROFILE
+	{ 'q', "Xfer:profile:read::", q_xfer_profile },
+#endif
+	{ 'q', "Rcmd,", q_rcmd },
+	{ 'q', "", q_modules },
+	{ 'Q', "StartNoAckMode", set_start_noack },
+	{ 'Q', "", set_trace },
+	{ 'v', "Cont?", v_cont_query },
+	{ 'v', "Cont;c", v_cont_continue },
+	{ 'v', "Cont;r", v_cont_range },
+	{ 'v', "Cont;s", v_cont_step },
+};
+
+// Run the handler of a q, Q or v packet. Unknown packets get an empty reply.
+static int ATTR_GDBFN gdb_handle_ext_command(uint8_t * cmd, size_t len) {
+	for (size_t i = 0; i < sizeof(gdb_ext_handlers) / sizeof(gdb_ext_handlers[0]); i++) {
+		struct gdb_ext_handler * h = &gdb_ext_handlers[i];
+		size_t prefix_len = strlen(h->prefix);
+
+		if (h->type != cmd[0] || strncmp((char *) &cmd[1], h->prefix, prefix_len) != 0) {
+			continue;
 		}
-		if (gdbstub_savedRegs.reason&(1<<3)) {
-			reason="swbreak";
+
+		uint32_t start = gdbstub_ccount();
+		int ret = h->fn(cmd, len, &cmd[1 + prefix_len]);
+
+		if (ret != ST_UNKNOWN) {
+			h->stats.calls++;
+			h->stats.cycles += gdbstub_ccount() - start;
+			return ret;
 		}
-		if (gdbstub_savedRegs.reason&(1<<4)) {
-			reason="swbreak";
+	}
+
+	gdb_packet_start();
+	gdb_packet_end();
+	return ST_ERR;
+}
+
+static void ATTR_GDBFN gdbstub_stats_print(const char * name, const struct gdbstub_handler_stats * stats) {
+	if (stats->calls != 0) {
+		gdbstub_monitor_printf("%-24s %8u %10u %12llu\n", name, (unsigned int) stats->calls,
+			(unsigned int) (stats->cycles / stats->calls), (unsigned long long) stats->cycles);
+	}
+}
+
+/*
+ * "monitor stats": packets and bytes each way, checksum errors, time spent
+ * stopped and the cost of the command handlers, cycles including queueing
+ * the reply. "monitor stats reset" clears them.
+ */
+bool ATTR_GDBFN gdbstub_monitor_stats(const char * args) {
+	if (strcmp(args, "reset") == 0) {
+		memset(&gdb_stats, 0, sizeof(gdb_stats));
+		memset(gdb_cmd_stats, 0, sizeof(gdb_cmd_stats));
+
+		for (size_t i = 0; i < sizeof(gdb_ext_handlers) / sizeof(gdb_ext_handlers[0]); i++) {
+			memset(&gdb_ext_handlers[i].stats, 0, sizeof(gdb_ext_handlers[i].stats));
 		}
 
-		gdb_packet_str(reason);
-		gdb_packet_char(':');
-		//TODO: watch: send address
-#endif
+		// The current stop counts from now on
+		gdb_stats.stops = 1;
+		gdb_stats.stopped_ccount = gdbstub_ccount();
+		return false;
+	}
+
+	gdb_stats_stopped_update();
+
+	gdbstub_monitor_printf("In:  %u packets, %u bytes, %u bad checksums\n", (unsigned int) gdb_stats.packets_in,
+		(unsigned int) gdb_stats.bytes_in, (unsigned int) gdb_stats.checksum_errors);
+	gdbstub_monitor_printf("Out: %u packets, %u bytes, %u rejected, %u console bytes dropped\n",
+		(unsigned int) gdb_stats.packets_out, (unsigned int) gdb_stats.bytes_out, (unsigned int) gdb_stats.naks,
+		(unsigned int) gdbstub_console_dropped);
+	gdbstub_monitor_printf("Stopped %u times, %llu cycles\n", (unsigned int) gdb_stats.stops,
+		(unsigned long long) gdb_stats.stopped_cycles);
+	gdbstub_monitor_printf("%-24s %8s %10s %12s\n", "Command", "Calls", "Cycles/call", "Cycles");
+
+	for (size_t i = 0; i < sizeof(gdb_stats_letters) - 1; i++) {
+		char name[2] = { gdb_stats_letters[i], 0 };
+
+		gdbstub_stats_print(name, &gdb_cmd_stats[i]);
+	}
+
+	gdbstub_stats_print("other", &gdb_cmd_stats[sizeof(gdb_stats_letters) - 1]);
+
+	for (size_t i = 0; i < sizeof(gdb_ext_handlers) / sizeof(gdb_ext_handlers[0]); i++) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "  %c%s", gdb_ext_handlers[i].type,
+			gdb_ext_handlers[i].prefix[0] != 0 ? gdb_ext_handlers[i].prefix : "...");
+		gdbstub_stats_print(name, &gdb_ext_handlers[i].stats);
+	}
+
+	return false;
+}
+
+// Find the saved value of a register of the current task. Returns NULL for
+// registers that are not saved and read as zero, like sr208.
+static uint32_t * ATTR_GDBFN gdbstub_reg_ptr(size_t regnum) {
+	switch (regnum) {
+	case GDB_REG_A0:
+		return &gdbstub_savedRegs.a0;
+	case GDB_REG_A1:
+		return &gdbstub_savedRegs.a1;
+	case GDB_REG_PC:
+		return &gdbstub_savedRegs.pc;
+	case GDB_REG_SAR:
+		return &gdbstub_savedRegs.sar;
+	case GDB_REG_LITBASE:
+		return &gdbstub_savedRegs.litbase;
+	case GDB_REG_SR176:
+		return &gdbstub_savedRegs.sr176;
+	case GDB_REG_PS:
+		return &gdbstub_savedRegs.ps;
+	default:
+		if (regnum <= GDB_REG_A15) {
+			return &gdbstub_savedRegs.a[regnum - 2];
+		}
+		return NULL;
 	}
+}
 
-#if GDBSTUB_THREAD_AWARE
-	gdbstub_freertos_report_thread();
-#endif
+// Value of a register of the current task, zero if it is not saved.
+uint32_t ATTR_GDBFN gdbstub_reg_get(size_t regnum) {
+	uint32_t * reg = gdbstub_reg_ptr(regnum);
 
-	gdb_packet_end();
+	return reg != NULL ? *reg : 0;
 }
 
-static bool gdbstub_process_query(uint8_t* cmd) {
-	char * query = (char *) &cmd[1];
+// Set a register of the current task, writes to registers that are not
+// saved are ignored.
+void ATTR_GDBFN gdbstub_reg_set(size_t regnum, uint32_t val) {
+	uint32_t * reg = gdbstub_reg_ptr(regnum);
 
-	const char * q_supported = "Supported";
+	if (reg != NULL) {
+		*reg = val;
+	}
+}
 
+// Set a register of the selected thread. Returns false for unknown registers.
+static bool ATTR_GDBFN gdbstub_write_reg(size_t regnum, uint32_t val) {
 #if GDBSTUB_THREAD_AWARE
-	const char * q_threads_read = "Xfer:threads:read";
-	const char * features =
-		"swbreak+;"
-		"hwbreak+;"
-		"qXfer:threads:read+;"
-		"PacketSize=255";
-#else
-	const char * features =
-		"swbreak+;"
-		"hwbreak+;"
-		"PacketSize=255";
+	if (!gdbstub_freertos_task_selected()) {
+		return gdbstub_freertos_reg_write(regnum, val);
+	}
 #endif
 
-	// TODO fix this shit
-	if (strncmp(query, q_supported, 9) == 0) {
-		// Capabilities query
-		gdb_packet_start();
-		gdb_packet_str(features);
-		gdb_packet_end();
+	if (regnum >= GDB_REG_COUNT) {
+		return false;
 	}
+
+	gdbstub_reg_set(regnum, val);
+	return true;
+}
+
+// Reply to 'p': send a single register of the selected thread.
+static void ATTR_GDBFN gdbstub_read_reg(size_t regnum) {
+	uint32_t val = 0;
+	bool valid = regnum < GDB_REG_COUNT;
+	bool available = true;
+
+	if (gdbstub_trace_frame_selected()) {
+		available = valid && gdbstub_trace_reg_read(regnum, &val);
+	} else
 #if GDBSTUB_THREAD_AWARE
-	else if (strncmp(query, q_threads_read, 17) == 0) {
-		gdbstub_freertos_task_list();
-	}
+	if (!gdbstub_freertos_task_selected()) {
+		valid = gdbstub_freertos_reg_read(regnum, &val);
+	} else
 #endif
-	else {
-		return false;
+	if (valid) {
+		val = gdbstub_reg_get(regnum);
 	}
 
-	return true;
+	gdb_packet_start();
+
+	if (!valid) {
+		gdb_packet_str("E01");
+	} else if (!available) {
+		// Not collected in the selected trace frame
+		gdb_packet_str("xxxxxxxx");
+	} else {
+		gdb_packet_hex(bswap32(val), 32);
+	}
+
+	gdb_packet_end();
 }
 
 static void gdbstub_read_regs() {
+	if (gdbstub_trace_frame_selected()) {
+		gdbstub_trace_regs_read();
+		return;
+	}
+
 #if GDBSTUB_THREAD_AWARE
 	/*
 	 * If the debugger wants to read state of the task
@@ -414,6 +1252,62 @@ static void gdbstub_read_regs() {
 	gdb_packet_end();
 }
 
+/*
+ * Attach the options of a Z packet to a breakpoint site, replacing the
+ * previous ones: conditions ";X len,expr...", optionally followed by
+ * commands ";cmds:persist,X len,expr...". GDB doesn't separate the
+ * expressions of a list. The bytecode is decoded in place.
+ */
+static bool ATTR_GDBFN gdb_parse_bp_options(uint8_t * data, const uint8_t * end, int site) {
+	int kind = BP_AX_CONDITION;
+
+	gdbstub_breakpoint_ax_clear(site);
+
+	while (data < end) {
+		if (data[0] == ';') {
+			data++;
+			continue;
+		}
+
+		if (end - data > 7 && strncmp((char *) data, "cmds:", 5) == 0) {
+			// skip 'cmds:persist,', there is no disconnected mode to persist into
+			data += 7;
+			kind = BP_AX_COMMAND;
+			continue;
+		}
+
+		if (data[0] != 'X') {
+			break;
+		}
+
+		data++;
+		size_t len = gdb_get_hex_val(&data, -1);
+		// skip ','
+		data++;
+
+		if (len == 0 || data + len * 2 > end) {
+			break;
+		}
+
+		uint8_t * code = data;
+
+		for (size_t k = 0; k < len; k++) {
+			code[k] = gdb_get_hex_val(&data, 8);
+		}
+
+		if (!gdbstub_breakpoint_ax_add(site, kind, code, len)) {
+			break;
+		}
+	}
+
+	if (data < end) {
+		gdbstub_breakpoint_ax_clear(site);
+		return false;
+	}
+
+	return true;
+}
+
 // Handle a command as received from GDB.
 static int ATTR_GDBFN gdb_handle_command(uint8_t * cmd, size_t len) {
 	// Handle a command
@@ -426,34 +1320,65 @@ static int ATTR_GDBFN gdb_handle_command(uint8_t * cmd, size_t len) {
 		gdbstub_read_regs();
 		break;
 	case gdb_cmd_write_regs:
-		// receive content for all registers from gdb
-		gdbstub_savedRegs.a0 = bswap32(gdb_get_hex_val(&data, 32));
-		gdbstub_savedRegs.a1 = bswap32(gdb_get_hex_val(&data, 32));
-
-		for (i = 2; i < 16; i++) {
-			gdbstub_savedRegs.a[i - 2] = bswap32(gdb_get_hex_val(&data, 32));
+		// receive content for all registers from gdb, in g packet order
+		if (data + GDB_REG_COUNT * 8 > cmd + len) {
+			// Don't write half of the registers
+			gdb_packet_start();
+			gdb_packet_str("E01");
+			gdb_packet_end();
+			break;
 		}
 
-		gdbstub_savedRegs.pc = bswap32(gdb_get_hex_val(&data, 32));
-		gdbstub_savedRegs.sar = bswap32(gdb_get_hex_val(&data, 32));
-		gdbstub_savedRegs.litbase = bswap32(gdb_get_hex_val(&data, 32));
-		gdbstub_savedRegs.sr176 = bswap32(gdb_get_hex_val(&data, 32));
-
-		gdb_get_hex_val(&data, 32);
+		for (i = 0; i < GDB_REG_COUNT; i++) {
+			gdbstub_write_reg(i, bswap32(gdb_get_hex_val(&data, 32)));
+		}
 
-		gdbstub_savedRegs.ps = bswap32(gdb_get_hex_val(&data, 32));
 		gdb_packet_start();
 		gdb_packet_str("OK");
 		gdb_packet_end();
 		break;
+	case gdb_cmd_read_reg:
+		// send one register to gdb
+		gdbstub_read_reg(gdb_get_hex_val(&data, -1));
+		break;
+	case gdb_cmd_write_reg:
+		// receive content for one register from gdb
+		i = gdb_get_hex_val(&data, -1);
+		// skip '='
+		data++;
+		j = bswap32(gdb_get_hex_val(&data, 32));
+		gdb_packet_start();
+		gdb_packet_str(i >= 0 && gdbstub_write_reg(i, j) ? "OK" : "E01");
+		gdb_packet_end();
+		break;
 	case gdb_cmd_memory_read:
 		// read memory to gdb
 		i = gdb_get_hex_val(&data, -1);
 		data++;
 		j = gdb_get_hex_val(&data, -1);
 		gdb_packet_start();
-		for (k = 0; k < j; k++) {
-			gdb_packet_hex(mem_read_byte(i++), 8);
+		if (gdbstub_trace_frame_selected()) {
+			gdb_trace_mem_send(i, j, false);
+		} else if (gdbstub_mem_valid(i, j, GDBSTUB_MEM_R)) {
+			mem_send(i, j, false);
+		} else {
+			gdb_packet_str("E01");
+		}
+		gdb_packet_end();
+		break;
+	case gdb_cmd_memory_read_bin:
+		// read memory to gdb as binary, one byte on the wire per byte unless it needs escaping
+		i = gdb_get_hex_val(&data, -1);
+		data++;
+		j = gdb_get_hex_val(&data, -1);
+		gdb_packet_start();
+		if (gdbstub_trace_frame_selected()) {
+			gdb_trace_mem_send(i, j, true);
+		} else if (gdbstub_mem_valid(i, j, GDBSTUB_MEM_R)) {
+			gdb_packet_char('b');
+			mem_send(i, j, true);
+		} else {
+			gdb_packet_str("E01");
 		}
 		gdb_packet_end();
 		break;
@@ -467,28 +1392,50 @@ static int ATTR_GDBFN gdb_handle_command(uint8_t * cmd, size_t len) {
 		j = gdb_get_hex_val(&data, -1);
 		data++;
 		// skip
-		if (mem_addr_valid(i) && mem_addr_valid(i+j)) {
+		if (j >= 0 && data + 2 * j <= cmd + len && gdbstub_mem_valid(i, j, GDBSTUB_MEM_W)) {
+			// Decode in place, the binary data never catches up with its hex form
+			uint8_t * bin = data;
+
 			for (k = 0; k < j; k++) {
-				mem_write_byte(i, gdb_get_hex_val(&data, 8));
-				i++;
+				bin[k] = gdb_get_hex_val(&data, 8);
 			}
 
-			// Make sure caches are up-to-date. Procedure according to Xtensa ISA document, ISYNC inst desc.
-			__asm volatile (
-				"isync \n"
-				"isync \n"
-			);
+			gdbstub_mem_write(i, bin, j);
 
 			gdb_packet_start();
 			gdb_packet_str("OK");
 			gdb_packet_end();
 		} else {
-			//Trying to do a software breakpoint on a flash proc, perhaps?
+			// Short packet, or trying to do a software breakpoint on a flash proc, perhaps?
 			gdb_packet_start();
 			gdb_packet_str("E01");
 			gdb_packet_end();
 		}
 		break;
+	case gdb_cmd_memory_write_bin:
+		// write binary memory from gdb, escapes were already removed by gdb_read_command
+		// addr
+		i = gdb_get_hex_val(&data, -1);
+		// skip ','
+		data++;
+		// length
+		j = gdb_get_hex_val(&data, -1);
+		// skip ':'
+		data++;
+
+		gdb_packet_start();
+
+		if (j == 0) {
+			// GDB probes for X support with an empty write
+			gdb_packet_str("OK");
+		} else if (data + j <= cmd + len && gdbstub_mem_write(i, data, j)) {
+			gdb_packet_str("OK");
+		} else {
+			gdb_packet_str("E01");
+		}
+
+		gdb_packet_end();
+		break;
 	case gdb_cmd_stop_reason:
 		// Reply with stop reason
 		gdb_send_reason();
@@ -496,32 +1443,26 @@ static int ATTR_GDBFN gdb_handle_command(uint8_t * cmd, size_t len) {
 	case gdb_cmd_continue:
 		return ST_CONT;
 		break;
+	case gdb_cmd_detach:
+		gdb_packet_start();
+		gdb_packet_str("OK");
+		gdb_packet_end();
+		// fall through
+	case gdb_cmd_kill:
+		// GDB goes away, the program keeps running with a plain console.
+		// The next GDB to connect starts out in ack mode.
+		gdb_tx_flush();
+		gdb_attached = false;
+		gdb_noack = false;
+		return ST_CONT;
 	case gdb_cmd_single_step:
 		gdbstub_single_step();
 		return ST_CONT;
 		break;
 	case gdb_cmd_long_name:
-		if (strncmp(cmd, "vCont?", 6) == 0) {
-			gdb_packet_start();
-			gdb_packet_str("vCont;c;s;r");
-			gdb_packet_end();
-		} else if (strncmp(cmd, "vCont;c", 7) == 0) {
-			// continue execution
-			return ST_CONT;
-		} else if (strncmp(cmd, "vCont;s", 7) == 0) {
-			gdbstub_single_step();
-			return ST_CONT;
-		}
-		break;
 	case gdb_cmd_query_ex:
-		// Extended query
-		if (!gdbstub_process_query(cmd)) {
-			// We weren't able to understand the query
-			gdb_packet_start();
-			gdb_packet_end();
-			return ST_ERR;
-		}
-		break;
+	case gdb_cmd_set_ex:
+		return gdb_handle_ext_command(cmd, len);
 	case gdb_cmd_hw_breakpoint_set:
 		// Set hardware break/watchpoint.
 		// skip 'x,'
@@ -533,10 +1474,22 @@ static int ATTR_GDBFN gdb_handle_command(uint8_t * cmd, size_t len) {
 		gdb_packet_start();
 
 		// Set breakpoint
-		if (cmd[1] == '1') {
-			if (gdbstub_set_hw_breakpoint(i, j)) {
+		if (cmd[1] == '0') {
+			if (!gdbstub_sw_breakpoint_set(i, j, BP_OWNER_GDB)) {
+				gdb_packet_str("E01");
+			} else if (gdb_parse_bp_options(data, cmd + len, gdbstub_breakpoint_site(i, false))) {
+				gdb_packet_str("OK");
+			} else {
+				gdbstub_sw_breakpoint_del(i, BP_OWNER_GDB);
+				gdb_packet_str("E01");
+			}
+		} else if (cmd[1] == '1') {
+			if (!gdbstub_hw_breakpoint_set(i, BP_OWNER_GDB)) {
+				gdb_packet_str("E01");
+			} else if (gdb_parse_bp_options(data, cmd + len, gdbstub_breakpoint_site(i, true))) {
 				gdb_packet_str("OK");
 			} else {
+				gdbstub_hw_breakpoint_del(i, BP_OWNER_GDB);
 				gdb_packet_str("E01");
 			}
 		} else if (cmd[1] == '2' || cmd[1] == '3' || cmd[1] == '4') {
@@ -605,6 +1558,12 @@ static int ATTR_GDBFN gdb_handle_command(uint8_t * cmd, size_t len) {
 		gdb_packet_str("OK");
 		gdb_packet_end();
 		break;
+	case gdb_cmd_thread_alive:
+		// Whether a thread still exists
+		gdb_packet_start();
+		gdb_packet_str(gdbstub_freertos_task_alive(gdb_get_hex_val(&data, -1)) ? "OK" : "E01");
+		gdb_packet_end();
+		break;
 #endif
 	case gdb_cmd_hw_breakpoint_clear:
 		// Clear hardware break/watchpoint
@@ -616,9 +1575,16 @@ static int ATTR_GDBFN gdb_handle_command(uint8_t * cmd, size_t len) {
 		j = gdb_get_hex_val(&data, -1);
 		gdb_packet_start();
 
-		if (cmd[1]=='1') {
+		if (cmd[1]=='0') {
+			// software breakpoint
+			if (gdbstub_sw_breakpoint_del(i, BP_OWNER_GDB)) {
+				gdb_packet_str("OK");
+			} else {
+				gdb_packet_str("E01");
+			}
+		} else if (cmd[1]=='1') {
 			// hardware breakpoint
-			if (gdbstub_del_hw_breakpoint(i)) {
+			if (gdbstub_hw_breakpoint_del(i, BP_OWNER_GDB)) {
 				gdb_packet_str("OK");
 			} else {
 				gdb_packet_str("E01");
@@ -657,9 +1623,14 @@ static int ATTR_GDBFN gdb_read_command() {
 
 	size_t p = 0;
 	uint8_t * ptr;
+	bool overflow = false;
 	c = gdb_recv_char();
 
 	if (c != '$') {
+		// In no-ack mode a '+' is only a late ack of the QStartNoAckMode reply
+		if (c == '-') {
+			gdb_stats.naks++;
+		}
 		return c;
 	}
 
@@ -674,6 +1645,7 @@ static int ATTR_GDBFN gdb_read_command() {
 			// Wut, restart packet?
 			chsum = 0;
 			p = 0;
+			overflow = false;
 			continue;
 		}
 		if (c == '}') {
@@ -682,9 +1654,12 @@ static int ATTR_GDBFN gdb_read_command() {
 			chsum += c;
 			c ^= 0x20;
 		}
-		cmd[p++] = c;
-		if (p >= PBUFLEN) {
-			return ST_ERR;
+		if (p < GDBSTUB_PBUFLEN - 1) {
+			cmd[p++] = c;
+		} else {
+			// Keep consuming the packet, otherwise its tail would be
+			// mistaken for the next command
+			overflow = true;
 		}
 	}
 
@@ -696,11 +1671,41 @@ static int ATTR_GDBFN gdb_read_command() {
 	rchsum = gdb_get_hex_val(&ptr, 8);
 
 	if (rchsum != chsum) {
-		gdb_send_char('-');
+		if (!gdb_noack) {
+			gdb_send_char('-');
+		}
+		gdb_stats.checksum_errors++;
 		return ST_ERR;
 	} else {
-		gdb_send_char('+');
-		return gdb_handle_command(cmd, p);
+		gdb_stats.packets_in++;
+
+		if (!gdb_noack) {
+			gdb_send_char('+');
+		}
+
+		// GDB got through, at the new baud rate if it was just changed
+		baud_fallback = 0;
+
+		if (overflow) {
+			// Retransmitting wouldn't help, reject the packet instead
+			gdb_packet_start();
+			gdb_packet_str("E01");
+			gdb_packet_end();
+			return ST_ERR;
+		}
+
+		uint32_t start = gdbstub_ccount();
+		int ret = gdb_handle_command(cmd, p);
+		gdbstub_cmd_ccount = gdbstub_ccount() - start;
+
+		// Letters not in the list, and an empty packet, count as "other"
+		const char * letter = cmd[0] != 0 ? strchr(gdb_stats_letters, cmd[0]) : NULL;
+		size_t slot = letter != NULL ? (size_t) (letter - gdb_stats_letters) : sizeof(gdb_stats_letters) - 1;
+		struct gdbstub_handler_stats * stats = &gdb_cmd_stats[slot];
+		stats->calls++;
+		stats->cycles += gdbstub_cmd_ccount;
+
+		return ret;
 	}
 }
 
@@ -758,6 +1763,24 @@ static void ATTR_GDBFN emulLdSt() {
 	}
 }
 
+// Serve GDB until it resumes the target.
+static void ATTR_GDBFN gdb_command_loop() {
+	gdb_stats.stops++;
+	gdb_stats.stopped_ccount = gdbstub_ccount();
+
+#if GDBSTUB_THREAD_AWARE
+	// Tasks may have come and gone since the last stop, whichever way the
+	// target stopped this time
+	gdbstub_freertos_task_refresh();
+#endif
+
+	while (gdb_read_command() != ST_CONT);
+	gdb_tx_flush();
+	rx_state = RX_CONSOLE;
+
+	gdb_stats_stopped_update();
+}
+
 // We just caught a debug exception and need to handle it. This is called from an assembly
 // routine in gdbstub-entry.S
 void ATTR_GDBFN gdbstub_handle_debug_exception() {
@@ -770,14 +1793,80 @@ void ATTR_GDBFN gdbstub_handle_debug_exception() {
 		single_step_ps = -1;
 	}
 
+	if (gdbstub_breakpoint_restore() && bp_step_over) {
+		// We have just stepped over a breakpoint that is back in place now.
+		// Unless something else happened on the way, carry on with the continue.
+		// A range step goes on below, with the next single step.
+		bp_step_over = false;
+
+		if ((gdbstub_savedRegs.reason & 0x3f) == (1 << 0) && range_step_end == 0) {
+			ets_wdt_enable();
+			return;
+		}
+	}
+
+	bp_step_over = false;
+
+	// IBREAK, BREAK or BREAK.N
+	bool bp_hit = (gdbstub_savedRegs.reason & 0x80) == 0
+		&& (gdbstub_savedRegs.reason & ((1 << 1) | (1 << 3) | (1 << 4))) != 0;
+
+	if (bp_hit && !gdbstub_breakpoint_check(gdbstub_savedRegs.pc, gdbstub_savedRegs.reason & (1 << 1))) {
+		// A tracepoint, all conditions of the breakpoint are false, or its
+		// commands (dprintf) have been run. Step over it and carry on without
+		// bothering GDB. Collecting a trace frame may end the experiment and
+		// remove the breakpoint, then there is nothing to step over.
+		gdbstub_trace_hit(gdbstub_savedRegs.pc);
+
+		if (gdbstub_breakpoint_lift(gdbstub_savedRegs.pc)) {
+			bp_step_over = true;
+			gdbstub_single_step();
+		}
+
+		gdb_tx_kick();
+
+		ets_wdt_enable();
+		return;
+	}
+
+	if (range_step_end != 0) {
+		uintptr_t pc = gdbstub_savedRegs.pc;
+
+		// Only the single step fired and we are still inside the range:
+		// keep stepping without a round trip to GDB.
+		if ((gdbstub_savedRegs.reason & 0x3f) == (1 << 0)
+				&& pc >= range_step_start && pc < range_step_end) {
+			gdbstub_single_step();
+			ets_wdt_enable();
+			return;
+		}
+
+		range_step_start = 0;
+		range_step_end = 0;
+	}
+
+	if (bp_hit) {
+		// GDB's breakpoint may share the address with a tracepoint
+		gdbstub_trace_hit(gdbstub_savedRegs.pc);
+	}
+
 	gdb_send_reason();
-	while (gdb_read_command() != ST_CONT);
+	gdb_command_loop();
 
 	if ((gdbstub_savedRegs.reason & 0x84) == 0x4) {
 		// We stopped due to a watchpoint. We can't re-execute the current instruction
 		// because it will happily re-trigger the same watchpoint, so we emulate it
 		// while we're still in debugger space.
 		emulLdSt();
+	}
+
+	if (gdbstub_breakpoint_lift(gdbstub_savedRegs.pc)) {
+		// There is one of our breakpoints where we resume. Execute the original
+		// instruction in a single step, the breakpoint goes back in afterwards.
+		if (single_step_ps == -1) {
+			bp_step_over = true;
+			gdbstub_single_step();
+		}
 	} else if ((gdbstub_savedRegs.reason & 0x88) == 0x8) {
 		// We stopped due to a BREAK instruction. Skip over it.
 		// Check the instruction first; gdb may have replaced it with the original instruction
@@ -792,7 +1881,7 @@ void ATTR_GDBFN gdbstub_handle_debug_exception() {
 		// actually is a BREAK.N
 		if ((mem_read_byte(gdbstub_savedRegs.pc + 1) & 0xf0) == 0xf0
 				&& mem_read_byte(gdbstub_savedRegs.pc) == 0x2d) {
-			gdbstub_savedRegs.pc += 3;
+			gdbstub_savedRegs.pc += 2;
 		}
 	}
 
@@ -806,8 +1895,7 @@ void ATTR_GDBFN gdbstub_handle_user_exception() {
 	// mark as an exception reason
 	gdbstub_savedRegs.reason |= 0x80;
 	gdb_send_reason();
-
-	while (gdb_read_command() != ST_CONT);
+	gdb_command_loop();
 
 	ets_wdt_enable();
 }
@@ -816,19 +1904,122 @@ extern void gdbstub_user_exception_entry();
 // This will override a weak symbol in esp-open-rtos
 void debug_exception_handler();
 
+static uint8_t ATTR_GDBFN rx_hex_digit(uint8_t c) {
+	return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+static void ATTR_GDBFN rx_stdin_put(uint8_t c) {
+	size_t next = (stdin_head + 1) & (GDBSTUB_STDIN_BUFLEN - 1);
+
+	if (next != stdin_tail) {
+		stdin_buf[stdin_head] = c;
+		stdin_head = next;
+	}
+}
+
+// The packet being received turned out to be console input that happened
+// to contain a '$'. Hand it to the application after all.
+static void ATTR_GDBFN rx_packet_to_stdin() {
+	for (size_t i = rx_packet_start; i != gdb_rx_head; i = (i + 1) & (GDBSTUB_RX_BUFLEN - 1)) {
+		rx_stdin_put(gdb_rx_buf[i]);
+	}
+
+	gdb_rx_head = rx_packet_start;
+	rx_state = RX_CONSOLE;
+}
+
 // TODO: use gdbstub stack for this function too
 void ATTR_GDBFN gdbstub_handle_uart_int() {
 	uint8_t do_debug = 0;
 	size_t fifolen = 0;
 
+#if GDBSTUB_TX_INTERRUPT
+	if (UART(0).INT_STATUS & UART_INT_STATUS_TXFIFO_EMPTY) {
+		gdb_tx_fill(0);
+		gdb_console_fill();
+		gdb_tx_fill(0);
+
+		if (gdb_tx_tail == gdb_tx_head) {
+			UART(0).INT_ENABLE &= ~UART_INT_ENABLE_TXFIFO_EMPTY;
+		}
+
+		UART(0).INT_CLEAR |= UART_INT_CLEAR_TXFIFO_EMPTY;
+	}
+#endif
+
 	fifolen = FIELD2VAL(UART_STATUS_RXFIFO_COUNT, UART(0).STATUS);
 
+	// Sort all received bytes into the GDB and the stdin buffer. Once that's
+	// done, a control-C outside of a packet or a packet with a valid checksum
+	// stops the target and attaches GDB. Acks for console output packets are
+	// dropped. Bytes that don't fit are lost, GDB retransmits its packets.
 	while (fifolen != 0) {
-		// Check if any of the chars is control-C. Throw away the rest.
-		if (((UART(0).FIFO) & 0xFF) == 0x3) {
-			do_debug = 1;
+		uint8_t c = UART(0).FIFO & 0xFF;
+		bool to_gdb = true;
+		bool packet_end = false;
+
+		switch (rx_state) {
+		case RX_CONSOLE:
+			if (c == '$') {
+				rx_state = RX_PACKET;
+				rx_sum = 0;
+				rx_packet_start = gdb_rx_head;
+			} else if (c == 0x3) {
+				do_debug = 1;
+				to_gdb = false;
+			} else if ((c == '+' || c == '-') && gdb_attached) {
+				to_gdb = false;
+			} else {
+				rx_stdin_put(c);
+				to_gdb = false;
+			}
+			break;
+		case RX_PACKET:
+			if ((c == '\r' || c == '\n') && !gdb_attached) {
+				// GDB doesn't send line ends outside of binary data, this
+				// is a line typed on the console
+				rx_packet_to_stdin();
+				rx_stdin_put(c);
+				to_gdb = false;
+			} else if (c == '#') {
+				rx_state = RX_CHECKSUM1;
+			} else {
+				rx_sum += c;
+			}
+			break;
+		case RX_CHECKSUM1:
+			rx_checksum = rx_hex_digit(c) << 4;
+			rx_state = RX_CHECKSUM2;
 			break;
+		case RX_CHECKSUM2:
+			rx_checksum |= rx_hex_digit(c);
+			rx_state = RX_CONSOLE;
+			packet_end = true;
+			break;
+		}
+
+		if (to_gdb) {
+			size_t next = (gdb_rx_head + 1) & (GDBSTUB_RX_BUFLEN - 1);
+
+			if (next != gdb_rx_tail) {
+				gdb_rx_buf[gdb_rx_head] = c;
+				gdb_rx_head = next;
+			} else if (!gdb_attached) {
+				// Too long for a packet GDB sends to connect
+				rx_packet_to_stdin();
+				rx_stdin_put(c);
+				packet_end = false;
+			}
+		}
+
+		if (packet_end) {
+			if (rx_checksum == rx_sum) {
+				do_debug |= 2;
+			} else if (!gdb_attached) {
+				rx_packet_to_stdin();
+			}
 		}
+
 		fifolen--;
 	}
 
@@ -863,8 +2054,19 @@ void ATTR_GDBFN gdbstub_handle_uart_int() {
 
 		ets_wdt_disable();
 
-		gdb_send_reason();
-		while (gdb_read_command() != ST_CONT);
+		if (do_debug & 1) {
+			gdb_send_reason();
+		} else {
+			// GDB connecting. It asks for the stop reason when it wants it.
+			// A new GDB after a detach starts out in ack mode.
+			if (!gdb_attached) {
+				gdb_noack = false;
+			}
+			gdb_console_flush();
+			gdb_attached = true;
+		}
+
+		gdb_command_loop();
 
 		ets_wdt_enable();
 
@@ -889,6 +2091,11 @@ static void ATTR_GDBINIT gdbstub_install_uart_handler() {
 
 	UART(0).INT_ENABLE |= UART_INT_ENABLE_RXFIFO_TIMEOUT | UART_INT_ENABLE_RXFIFO_FULL;
 
+#if GDBSTUB_TX_INTERRUPT
+	// Refill when the FIFO runs low rather than when it is completely empty
+	UART(0).CONF1 = SET_FIELD(UART(0).CONF1, UART_CONF1_TXFIFO_EMPTY_THRESHOLD, UART_FIFO_MAX / 4);
+#endif
+
 	// enable UART interrupt
 	uint32_t intenable;
 	__asm volatile (
@@ -899,22 +2106,82 @@ static void ATTR_GDBINIT gdbstub_install_uart_handler() {
 }
 
 static ssize_t gdbstub_stdout_write(struct _reent *r, int fd, const void *ptr, size_t len) {
-	gdb_packet_start();
-	gdb_packet_char('O');
+	const char * c = ptr;
+	bool line_end = false;
+
+	// The UART interrupt drains the same buffers, keep it out while queueing
+	taskENTER_CRITICAL();
 
 	for (size_t i = 0; i < len; i++) {
-		gdb_packet_hex(((const char *) ptr)[i], 8);
+		size_t next = (console_head + 1) & (GDBSTUB_CONSOLE_BUFLEN - 1);
+
+		if (next == console_tail) {
+#if GDBSTUB_CONSOLE_BLOCK
+			while (next == console_tail) {
+				gdb_console_fill();
+				gdb_tx_fill(UART_FIFO_MAX / 4);
+			}
+#else
+			gdbstub_console_dropped += len - i;
+			break;
+#endif
+		}
+
+		console_buf[console_head] = c[i];
+		console_head = next;
+		line_end |= c[i] == '\n';
 	}
 
-	gdb_packet_end();
+	if (line_end || gdb_tx_tail == gdb_tx_head
+			|| ((console_head - console_tail) & (GDBSTUB_CONSOLE_BUFLEN - 1)) >= GDBSTUB_CONSOLE_FLUSH) {
+#if GDBSTUB_TX_INTERRUPT
+		gdb_console_fill();
+		gdb_tx_kick();
+#else
+		gdb_console_flush();
+		gdb_tx_flush();
+#endif
+	}
+
+	taskEXIT_CRITICAL();
 	return len;
 }
 
+/*
+ * Replaces the weak stdin reader of esp-open-rtos, which would take bytes
+ * from the UART FIFO the stub owns. Waits for at least one byte.
+ */
+long _read_stdin_r(struct _reent *r, int fd, char *ptr, int len) {
+	int n = 0;
+
+	while (stdin_tail == stdin_head) {
+		vTaskDelay(1);
+	}
+
+	while (n < len && stdin_tail != stdin_head) {
+		ptr[n++] = stdin_buf[stdin_tail];
+		stdin_tail = (stdin_tail + 1) & (GDBSTUB_STDIN_BUFLEN - 1);
+	}
+
+	return n;
+}
+
+#if !GDBSTUB_THREAD_AWARE
+// There are no task statistics to keep, but the hook in FreeRTOSConfig.h
+// has to link all the same.
+void gdbstub_freertos_task_switched_in() {
+}
+#endif
+
 void ATTR_GDBINIT gdbstub_init() {
 	// install stdout wrapper
 	set_write_stdout(gdbstub_stdout_write);
 
 	// install UART interrupt handler
 	gdbstub_install_uart_handler();
+
+#if GDBSTUB_PROFILE
+	gdbstub_profile_init();
+#endif
 }
 
@@ -1,6 +1,8 @@
 #ifndef GDBSTUB_H
 #define GDBSTUB_H
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,6 +10,19 @@ extern "C" {
 void gdbstub_init();
 void gdbstub_do_break();
 
+// Per-task CPU time for "monitor tasks", call it from traceTASK_SWITCHED_IN.
+// Does nothing in builds without thread support.
+void gdbstub_freertos_task_switched_in();
+
+// Application commands for GDB's "monitor". They run while the target is
+// stopped, so they must not block or use the RTOS, and get the text after
+// the command name. Output goes to the GDB console with
+// gdbstub_monitor_printf().
+typedef void (* gdbstub_monitor_fn)(const char * args);
+
+bool gdbstub_monitor_register(const char * name, gdbstub_monitor_fn fn, const char * help);
+void gdbstub_monitor_printf(const char * fmt, ...);
+
 #define gdbstub_do_break() { __asm volatile ("break 0,0"); }
 
 #ifdef __cplusplus
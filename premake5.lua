@@ -3,6 +3,11 @@ newoption {
 	description = "Enable RTOS task debugging"
 }
 
+newoption {
+	trigger = "with-profiler",
+	description = "Enable the sampling profiler (takes the FRC1 timer)"
+}
+
 newoption {
 	trigger = "with-eor",
 	description = "Specify esp-open-rtos path"
@@ -38,6 +43,11 @@ project "esp-gdbstub"
 	}
 	files {
 		"gdbstub.c",
+		"gdbstub-ax.c",
+		"gdbstub-breakpoints.c",
+		"gdbstub-trace.c",
+		"gdbstub-profile.c",
+		"gdbstub-monitor.c",
 		"gdbstub-entry.S"
 	}
 	configuration "with-threads"
@@ -47,4 +57,5 @@ project "esp-gdbstub"
 		}
 	configuration "not with-threads"
 		defines { "GDBSTUB_THREAD_AWARE=0" }
-
+	configuration "with-profiler"
+		defines { "GDBSTUB_PROFILE=1" }
@@ -0,0 +1,81 @@
+"""
+Change the baud rate of a GDB session with the gdbstub at runtime.
+
+Inside GDB, connected to the target over a serial port:
+
+    (gdb) source tools/gdbstub-baud.py
+    (gdb) gdbstub-baud 921600
+
+asks the stub to switch (monitor baud), switches the local serial port to
+match and confirms the new rate with the stub. The stub goes back to the
+old rate by itself when the confirmation doesn't arrive within 2 seconds,
+and so does this command when the confirmation fails.
+"""
+
+import os
+import termios
+
+import gdb
+
+
+def tty_speed(rate):
+    speed = getattr(termios, "B%d" % rate, None)
+    if speed is None:
+        raise gdb.GdbError("the host doesn't support %d baud" % rate)
+    return speed
+
+
+def tty_get_speed(device):
+    fd = os.open(device, os.O_RDONLY | os.O_NOCTTY | os.O_NONBLOCK)
+    try:
+        return termios.tcgetattr(fd)[4]
+    finally:
+        os.close(fd)
+
+
+def tty_set_speed(device, speed):
+    # The speed is a property of the tty, changing it here also changes it
+    # for the file descriptor GDB has open
+    fd = os.open(device, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+    try:
+        attrs = termios.tcgetattr(fd)
+        attrs[4] = attrs[5] = speed
+        termios.tcsetattr(fd, termios.TCSADRAIN, attrs)
+    finally:
+        os.close(fd)
+
+
+class BaudCommand(gdb.Command):
+    """Switch the serial link to the gdbstub to another baud rate.
+Usage: gdbstub-baud RATE"""
+
+    def __init__(self):
+        super().__init__("gdbstub-baud", gdb.COMMAND_SUPPORT)
+
+    def invoke(self, arg, from_tty):
+        try:
+            rate = int(arg)
+        except ValueError:
+            raise gdb.GdbError("usage: gdbstub-baud RATE")
+
+        device = gdb.selected_inferior().connection.details
+        if not device or not device.startswith("/dev/"):
+            raise gdb.GdbError("not connected over a serial port: %r" % device)
+
+        new_speed = tty_speed(rate)
+        old_speed = tty_get_speed(device)
+
+        gdb.execute("monitor baud %d" % rate)
+        tty_set_speed(device, new_speed)
+
+        try:
+            gdb.execute("monitor baud")
+        except gdb.error:
+            tty_set_speed(device, old_speed)
+            raise gdb.GdbError("the stub didn't answer at %d baud, staying at the old rate" % rate)
+
+        # Used when GDB opens the port again
+        gdb.execute("set serial baud %d" % rate)
+
+
+BaudCommand()
@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+"""
+Flat profile from the samples of the gdbstub sampling profiler
+(GDBSTUB_PROFILE=1).
+
+Inside GDB (14 or newer), connected to the target:
+
+    (gdb) source tools/gdbstub-profile.py
+    (gdb) gdbstub-profile [samples.bin]
+
+downloads the samples (qXfer:profile:read), optionally saves them, and
+prints the profile using the symbols GDB has loaded.
+
+Offline, from saved samples and the firmware ELF:
+
+    tools/gdbstub-profile.py samples.bin firmware.elf [--nm xtensa-lx106-elf-nm]
+"""
+
+import argparse
+import bisect
+import collections
+import struct
+import subprocess
+import sys
+
+HEADER = struct.Struct("<4sHHIII")
+TASK_NAME_LEN = 16
+
+
+def parse(blob):
+    """Decode a profile blob into (header dict, [(pc, task)], {task: name})."""
+    magic, version, flags, hz, total, count = HEADER.unpack_from(blob, 0)
+
+    if magic != b"GPRF" or version != 1:
+        raise ValueError("not a gdbstub profile (magic %r, version %d)" % (magic, version))
+
+    with_tasks = flags & 1
+    offset = HEADER.size
+    samples = []
+
+    for _ in range(count):
+        if with_tasks:
+            pc, task = struct.unpack_from("<II", blob, offset)
+            offset += 8
+        else:
+            pc, = struct.unpack_from("<I", blob, offset)
+            task = None
+            offset += 4
+        samples.append((pc, task))
+
+    names = {}
+
+    if with_tasks:
+        task_count, = struct.unpack_from("<I", blob, offset)
+        offset += 4
+
+        for _ in range(task_count):
+            handle, = struct.unpack_from("<I", blob, offset)
+            name = blob[offset + 4:offset + 4 + TASK_NAME_LEN].split(b"\0")[0]
+            names[handle] = name.decode("ascii", "replace")
+            offset += 4 + TASK_NAME_LEN
+
+    return {"hz": hz, "total": total, "count": count}, samples, names
+
+
+class NmSymbols:
+    """pc to function lookup based on the symbol table of the ELF."""
+
+    def __init__(self, elf, nm):
+        out = subprocess.run([nm, "-n", "-S", "--defined-only", elf],
+                             check=True, capture_output=True, text=True).stdout
+        self.addrs = []
+        self.syms = []
+
+        for line in out.splitlines():
+            fields = line.split()
+            if len(fields) < 3 or fields[-2].lower() not in ("t", "w"):
+                continue
+            self.addrs.append(int(fields[0], 16))
+            size = int(fields[1], 16) if len(fields) == 4 else 0
+            self.syms.append((fields[-1], size))
+
+    def __call__(self, pc):
+        i = bisect.bisect_right(self.addrs, pc) - 1
+        if i < 0:
+            return None
+        name, size = self.syms[i]
+        if size and pc >= self.addrs[i] + size:
+            return None
+        return name
+
+
+def report(info, samples, names, lookup, out=sys.stdout):
+    count = len(samples)
+
+    out.write("%d samples at %d Hz (%d taken, %d overwritten)\n\n"
+              % (count, info["hz"], info["total"], info["total"] - count))
+
+    if count == 0:
+        return
+
+    funcs = collections.Counter(lookup(pc) or "0x%08x" % pc for pc, _ in samples)
+
+    out.write("     %  samples  function\n")
+    for func, n in funcs.most_common():
+        out.write("%6.2f %8d  %s\n" % (100.0 * n / count, n, func))
+
+    if samples[0][1] is None:
+        return
+
+    tasks = collections.Counter(task for _, task in samples)
+
+    out.write("\n     %  samples  task\n")
+    for task, n in tasks.most_common():
+        out.write("%6.2f %8d  %s\n" % (100.0 * n / count, n, names.get(task, "0x%08x" % task)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flat profile from gdbstub profiler samples")
+    parser.add_argument("samples", help="samples saved by the gdbstub-profile GDB command")
+    parser.add_argument("elf", help="firmware ELF file")
+    parser.add_argument("--nm", default="xtensa-lx106-elf-nm", help="nm of the toolchain")
+    args = parser.parse_args()
+
+    with open(args.samples, "rb") as f:
+        info, samples, names = parse(f.read())
+
+    report(info, samples, names, NmSymbols(args.elf, args.nm))
+
+
+try:
+    import gdb
+except ImportError:
+    gdb = None
+
+if gdb is not None:
+    def unescape(data):
+        # Binary qXfer replies escape #, $, } and * as } followed by c ^ 0x20
+        out = bytearray()
+        i = 0
+        while i < len(data):
+            if data[i] == 0x7d:
+                i += 1
+                out.append(data[i] ^ 0x20)
+            else:
+                out.append(data[i])
+            i += 1
+        return bytes(out)
+
+    def download():
+        conn = gdb.selected_inferior().connection
+        if not hasattr(conn, "send_packet"):
+            raise gdb.GdbError("downloading the samples needs a remote connection and GDB 14 or newer")
+        blob = b""
+
+        while True:
+            reply = conn.send_packet("qXfer:profile:read::%x,%x" % (len(blob), 0x200))
+            if isinstance(reply, str):
+                reply = reply.encode("latin-1")
+            if not reply or reply[:1] not in (b"m", b"l"):
+                raise gdb.GdbError("target doesn't support qXfer:profile:read: %r" % reply)
+            blob += unescape(reply[1:])
+            if reply[:1] == b"l":
+                return blob
+
+    def gdb_lookup(pc):
+        block = gdb.block_for_pc(pc)
+        while block is not None and block.function is None:
+            block = block.superblock
+        if block is not None:
+            return block.function.print_name
+        sym = gdb.execute("info symbol 0x%x" % pc, to_string=True)
+        return None if sym.startswith("No symbol") else sym.split()[0]
+
+    class ProfileCommand(gdb.Command):
+        """Download the gdbstub profiler samples and print a flat profile.
+Usage: gdbstub-profile [FILE]
+Saves the raw samples to FILE when given."""
+
+        def __init__(self):
+            super().__init__("gdbstub-profile", gdb.COMMAND_DATA, gdb.COMPLETE_FILENAME)
+
+        def invoke(self, arg, from_tty):
+            blob = download()
+
+            if arg:
+                with open(arg, "wb") as f:
+                    f.write(blob)
+
+            info, samples, names = parse(blob)
+            report(info, samples, names, gdb_lookup, gdb)
+
+    ProfileCommand()
+elif __name__ == "__main__":
+    main()